@@ -7,11 +7,23 @@
 #include "mutex"
 #include "fstream"
 #include "chrono"
+#include "cerrno"
 #include "regex"
 #include "sstream"
 #include "termios.h"
+#include "unistd.h"
+#include "netdb.h"
+#include "sys/socket.h"
+#include "sys/stat.h"
+#include "sys/time.h"
 #include "connectionplugins/connectiontcp.h"
+#include "gsl/gsl_errno.h"
 #include "indicom.h"
+#include "libnova/earth.h"
+#include "libnova/lunar.h"
+#include "libnova/parallax.h"
+#include "libnova/solar.h"
+#include "polaris_common.h"
 
 // using namespace INDI::AlignmentSubsystem;
 
@@ -44,9 +56,52 @@ const int MODE_UPDATE_REFRESH_AGE = std::chrono::duration_cast<std::chrono::mill
 const int POLLING_PERIOD = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::seconds(1)).count();
 const int KEEPALIVE_PERIOD = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::milliseconds(500)).count();
 
+const double UNIX_EPOCH_JD = 2440587.5;
+const int BATCH_POLL_PERIOD = 100; // ms, while waiting for the last responses of a batch
+const double LATENCY_MAX_ROUND_TRIP = 5.; // seconds, older pending requests lost their response
+const double LATENCY_SMOOTHING = 1. / 8;   // same gain TCP uses for its smoothed round trip time
+const size_t RECEIVE_BUFFER_MAX = 4096;
+const double LINK_MIN_TIMEOUT = 5.;       // seconds without any frame before the link is declared dead
+const double LINK_ROUND_TRIP_FACTOR = 8.; // ... or this many smoothed round trips, whichever is longer
+const double LINK_CONNECT_TIMEOUT = 3.;   // seconds, per background reconnect attempt
+const double LINK_RETRY_PERIOD = 2.;      // seconds between failed reconnect attempts
+
+const double POSE_MEASUREMENT_SIGMA = 0.003;  // deg, AHRS noise of a single 518 sample
+const double POSE_ACCELERATION_SIGMA = 0.002; // deg/s^2, tracking barely accelerates, slews restart the filter
+const double STATE_POSE_MAX_AGE = 30.;        // seconds, older cached poses are not published on connect
+const double POSE_MAX_EXTRAPOLATION = 2.;     // seconds past the last sample we still publish predictions
+const double PARK_SETTLED_MOTION = 0.01; // deg, smaller pose changes don't count as moving
+const double PARK_SETTLE_TIME = 2.;      // seconds without motion before an axis counts as settled
+const double PARK_TIMEOUT = 180.;        // seconds, per park stage
+const double PARK_MAX_SAMPLE_GAP = 1.;   // seconds between 518 samples, longer gaps restart the settle window
+const double PARK_MIN_STAGE_TIME = 10.;  // seconds, a stage without any motion completes no earlier
+
+const double TRACK_RATE_REFRESH = 600.;    // seconds between ephemeris evaluations of the differential rates
+const double TRACK_RATE_BASELINE = 600.;   // seconds between the two ephemeris positions, the window a rate is applied over
+const double KM_PER_AU = 149597870.7;
+const double TRACK_CORRECTION_STEP = 3.;   // arcsec of target motion before the mount is re-pointed
+
+const double ROTATION_MIN_COS_ALT = 0.01;     // keeps the rate finite at the zenith
+const double ROTATION_EXPOSURE_CAP = 3600.;   // seconds, reported where the field barely rotates
+const double SIDEREAL_RATE = 2 * M_PI / 86164.0905; // rad/s
+
+const double PEC_MAX_RESIDUAL = 600.; // arcsec, larger residuals mean the mount is slewing, not tracking
+
 static std::unique_ptr<BenroPolaris> polaris(new BenroPolaris());
 
-BenroPolaris::BenroPolaris() {
+BenroPolaris::~BenroPolaris() {
+    if (reconnectThread.joinable()) {
+        reconnectThread.join();
+    }
+    if (reconnectFd >= 0) {
+        close(reconnectFd);
+    }
+}
+
+BenroPolaris::BenroPolaris() : poseFilter(POSE_MEASUREMENT_SIGMA, POSE_ACCELERATION_SIGMA) {
+    // GSL aborts on errors by default, the pose filter and PEC check return codes instead
+    gsl_set_error_handler_off();
+
     setVersion(0, 1);
     setTelescopeConnection(CONNECTION_TCP);
 
@@ -60,10 +115,10 @@ BenroPolaris::BenroPolaris() {
         // ? TELESCOPE_HAS_TIME                  | /** Does the telescope have configurable date and time settings? */
         // ? TELESCOPE_HAS_LOCATION              | /** Does the telescope have configuration location settings? */
         // TELESCOPE_HAS_PIER_SIDE             | /** Does the telescope have pier side property? */
-        // TELESCOPE_HAS_PEC                   | /** Does the telescope have PEC playback? */
+        TELESCOPE_HAS_PEC                   | /** Does the telescope have PEC playback? */
         TELESCOPE_HAS_TRACK_MODE            | /** Does the telescope have track modes (sidereal, lunar, solar..etc)? */
-        TELESCOPE_CAN_CONTROL_TRACK          /** Can the telescope engage and disengage tracking? */
-        // TELESCOPE_HAS_TRACK_RATE            | /** Does the telescope have custom track rates? */
+        TELESCOPE_CAN_CONTROL_TRACK         | /** Can the telescope engage and disengage tracking? */
+        TELESCOPE_HAS_TRACK_RATE              /** Does the telescope have custom track rates? */
         // TELESCOPE_HAS_PIER_SIDE_SIMULATION  | /** Does the telescope simulate the pier side property? */
         // TELESCOPE_CAN_TRACK_SATELLITE       | /** Can the telescope track satellites? */
         // TELESCOPE_CAN_FLIP                  | /** Does the telescope have a command for flipping? */
@@ -96,7 +151,13 @@ bool BenroPolaris::initProperties() {
     defineProperty(AltAzNP);
     AltAzNP.load();
 
-    DeviceInfoTP[ASTRO_MODULE_VERSION].fill("HARDWARE_VERSION", "Head hadware version", "-");
+    PoseNP[POSE_AZ_RATE].fill("POSE_AZ_RATE", "Azm rate (arcsec/s)", "%.2f", -99999., 99999., 0., 0.);
+    PoseNP[POSE_ALT_RATE].fill("POSE_ALT_RATE", "Alt rate (arcsec/s)", "%.2f", -99999., 99999., 0., 0.);
+    PoseNP[POSE_SIGMA].fill("POSE_SIGMA", "Uncertainty (arcsec)", "%.2f", 0., 99999., 0., 0.);
+    PoseNP[POSE_REJECTED].fill("POSE_REJECTED", "Rejected samples", "%.0f", 0., 99999., 0., 0.);
+    PoseNP.fill(getDeviceName(), "POSE_ESTIMATE", "Pose Estimate", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
+
+    DeviceInfoTP[HARDWARE_VERSION].fill("HARDWARE_VERSION", "Head hadware version", "-");
     DeviceInfoTP[SOFTWARE_VERSION].fill("SOFTWARE_VERSION", "Head software version", "-");
     DeviceInfoTP[ASTRO_MODULE_VERSION].fill("ASTRO_MODULE_VERSION", "Astro module version", "-");
     DeviceInfoTP[SV].fill("???", "???", "-");
@@ -111,10 +172,65 @@ bool BenroPolaris::initProperties() {
     BatteryNP[CAPACITY].fill("BATTERY", "Battery (%)", "%3.0f", 0., 100., 0., 0.);
     BatteryNP.fill(getDeviceName(), "BATTERY", "Battery", INFO_TAB, IP_RO, 0, IPS_IDLE);
 
+    LatencyNP[LATENCY_RTT].fill("LATENCY_RTT", "Round trip (ms)", "%.1f", 0., 99999., 0., 0.);
+    LatencyNP[LATENCY_RTT_MIN].fill("LATENCY_RTT_MIN", "Min round trip (ms)", "%.1f", 0., 99999., 0., 0.);
+    LatencyNP[LATENCY_DELAY].fill("LATENCY_DELAY", "Pose delay (ms)", "%.1f", 0., 99999., 0., 0.);
+    LatencyNP.fill(getDeviceName(), "LINK_LATENCY", "Link Latency", INFO_TAB, IP_RO, 0, IPS_IDLE);
+
+    LinkNP[LINK_AGE].fill("LINK_AGE", "Last frame (s)", "%.1f", 0., 99999., 0., 0.);
+    LinkNP[LINK_TIMEOUT].fill("LINK_TIMEOUT", "Dead after (s)", "%.1f", 0., 99999., 0., LINK_MIN_TIMEOUT);
+    LinkNP[LINK_DROPOUTS].fill("LINK_DROPOUTS", "Dropouts", "%.0f", 0., 99999., 0., 0.);
+    LinkNP[LINK_OUTAGE].fill("LINK_OUTAGE", "Last outage (s)", "%.1f", 0., 99999., 0., 0.);
+    LinkNP[LINK_RECOVERY].fill("LINK_RECOVERY", "Last recovery (s)", "%.1f", 0., 99999., 0., 0.);
+    LinkNP.fill(getDeviceName(), "LINK_HEALTH", "Link Health", INFO_TAB, IP_RO, 0, IPS_IDLE);
+
     CommandTP[REQUEST].fill("REQUEST", "Request", "");
     CommandTP[RESPONSE].fill("RESPONSE", "Response", "");
     CommandTP.fill(getDeviceName(), "COMMAND", "Command", MAIN_CONTROL_TAB, IP_RW, 0, IPS_IDLE);
+
+    CommandBatchTP[BATCH_FRAMES].fill("BATCH_FRAMES", "Frames", "");
+    CommandBatchTP[BATCH_SCRIPT].fill("BATCH_SCRIPT", "Script file", "");
+    CommandBatchTP[BATCH_OUTPUT].fill("BATCH_OUTPUT", "Results file", "");
+    CommandBatchTP.fill(getDeviceName(), "COMMAND_BATCH", "Command Batch", MAIN_CONTROL_TAB, IP_RW, 0, IPS_IDLE);
+
+    CommandBatchNP[BATCH_SPACING].fill("BATCH_SPACING", "Spacing (ms)", "%.0f", 0., 10000., 50., 200.);
+    CommandBatchNP[BATCH_TIMEOUT].fill("BATCH_TIMEOUT", "Response timeout (ms)", "%.0f", 100., 60000., 100., 5000.);
+    CommandBatchNP.fill(getDeviceName(), "COMMAND_BATCH_SETTINGS", "Batch Settings", MAIN_CONTROL_TAB, IP_RW, 0, IPS_IDLE);
+
+    PecControlSP[PEC_RECORD].fill("PEC_RECORD", "Record", ISS_OFF);
+    PecControlSP[PEC_ANALYZE].fill("PEC_ANALYZE", "Analyze", ISS_OFF);
+    PecControlSP[PEC_CLEAR].fill("PEC_CLEAR", "Clear", ISS_OFF);
+    PecControlSP.fill(getDeviceName(), "PEC_CONTROL", "PEC Recording", MOTION_TAB, IP_RW, ISR_ATMOST1, 0, IPS_IDLE);
+
+    PecSettingsNP[PEC_TERMS].fill("PEC_TERMS", "Terms per axis", "%.0f", 1., 8., 1., 3.);
+    PecSettingsNP[PEC_THRESHOLD].fill("PEC_THRESHOLD", "Correction step (arcsec)", "%.1f", 0.5, 60., 0.5, 3.);
+    PecSettingsNP.fill(getDeviceName(), "PEC_SETTINGS", "PEC Settings", MOTION_TAB, IP_RW, 0, IPS_IDLE);
+
+    RotationNP[ROTATION_ANGLE].fill("ROTATION_ANGLE", "Parallactic angle (deg)", "%.2f", -180., 180., 0., 0.);
+    RotationNP[ROTATION_RATE].fill("ROTATION_RATE", "Rotation rate (deg/min)", "%.4f", -99999., 99999., 0., 0.);
+    RotationNP[ROTATION_MAX_EXPOSURE].fill("ROTATION_MAX_EXPOSURE", "Max exposure (s)", "%.1f", 0., ROTATION_EXPOSURE_CAP, 0., 0.);
+    RotationNP.fill(getDeviceName(), "FIELD_ROTATION", "Field Rotation", MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
+
+    RotationSettingsNP[ROTATION_BUDGET].fill("ROTATION_BUDGET", "Smear budget (arcsec)", "%.1f", 0.1, 60., 0.1, 1.);
+    RotationSettingsNP[ROTATION_FIELD_RADIUS].fill("ROTATION_FIELD_RADIUS", "Field radius (arcmin)", "%.1f", 1., 600., 1., 30.);
+    RotationSettingsNP.fill(getDeviceName(), "FIELD_ROTATION_SETTINGS", "Rotation Settings", MAIN_CONTROL_TAB, IP_RW, 0, IPS_IDLE);
+
+    PecStatsNP[PEC_SAMPLES].fill("PEC_SAMPLES", "Samples", "%.0f", 0., 99999., 0., 0.);
+    PecStatsNP[PEC_PERIOD].fill("PEC_PERIOD", "Dominant period (s)", "%.1f", 0., 99999., 0., 0.);
+    PecStatsNP[PEC_RMS_BEFORE].fill("PEC_RMS_BEFORE", "RMS before (arcsec)", "%.2f", 0., 99999., 0., 0.);
+    PecStatsNP[PEC_RMS_FIT].fill("PEC_RMS_FIT", "Model fit residual (arcsec)", "%.2f", 0., 99999., 0., 0.);
+    PecStatsNP[PEC_RMS_AFTER].fill("PEC_RMS_AFTER", "RMS in playback (arcsec)", "%.2f", 0., 99999., 0., 0.);
+    PecStatsNP.fill(getDeviceName(), "PEC_STATS", "PEC Residuals", MOTION_TAB, IP_RO, 0, IPS_IDLE);
     
+    AddTrackMode("TRACK_SIDEREAL", "Sidereal", true);
+    AddTrackMode("TRACK_SOLAR", "Solar");
+    AddTrackMode("TRACK_LUNAR", "Lunar");
+    AddTrackMode("TRACK_CUSTOM", "Custom");
+
+    SetParkDataType(PARK_AZ_ALT);
+
+    LoadState();
+
     setCurrentPollingPeriod(POLLING_PERIOD);
     return parentInitialised;
 }
@@ -131,19 +247,57 @@ bool BenroPolaris::updateProperties() {
         WriteRequest(EncodeRequest(CMD_775_STORAGE, 2));
         WriteRequest(EncodeRequest(CMD_778_BATTERY, 2));
 
+        // park data only keeps the park position, the head's home (default) lives in the state file
+        const PolarisState *state = stateFile.Get();
+        const bool cached = state != nullptr && state->parkValid;
+        if (!InitPark()) {
+            // no park data yet, the home pose is learned the first time the axes are reset
+            SetAxis1Park(cached ? state->parkAz : 0);
+            SetAxis2Park(cached ? state->parkAlt : 0);
+        }
+        SetAxis1ParkDefault(cached ? state->parkDefaultAz : 0);
+        SetAxis2ParkDefault(cached ? state->parkDefaultAlt : 0);
+
+        defineProperty(PoseNP);
+        defineProperty(RotationNP);
+        defineProperty(RotationSettingsNP);
+        RotationSettingsNP.load();
         defineProperty(DeviceInfoTP);
         DeviceInfoTP.load();
         defineProperty(StorageNP);
         StorageNP.load();
         defineProperty(BatteryNP);
         BatteryNP.load();
+        defineProperty(LatencyNP);
+        defineProperty(LinkNP);
         defineProperty(CommandTP);
         CommandTP.load();
+        defineProperty(CommandBatchTP);
+        defineProperty(CommandBatchNP);
+        CommandBatchNP.load();
+        defineProperty(PecControlSP);
+        defineProperty(PecSettingsNP);
+        PecSettingsNP.load();
+        defineProperty(PecStatsNP);
+
+        if (!poseFilter.IsInitialized()) {
+            RestoreCachedPose(ln_get_julian_from_sys());
+        }
     } else {
+        deleteProperty(PoseNP);
+        deleteProperty(RotationNP);
+        deleteProperty(RotationSettingsNP);
         deleteProperty(DeviceInfoTP);
         deleteProperty(StorageNP);
         deleteProperty(BatteryNP);
+        deleteProperty(LatencyNP);
+        deleteProperty(LinkNP);
         deleteProperty(CommandTP);
+        deleteProperty(CommandBatchTP);
+        deleteProperty(CommandBatchNP);
+        deleteProperty(PecControlSP);
+        deleteProperty(PecSettingsNP);
+        deleteProperty(PecStatsNP);
     }
     
     return parentUpdated;
@@ -174,6 +328,30 @@ bool BenroPolaris::ISNewBLOB(const char *dev, const char *name, int sizes[], int
  ***************************************************************************************/
 bool BenroPolaris::ISNewNumber(const char *dev, const char *name, double values[], char *names[], int n) {
     LOGF_INFO("ISNewNumber: %s", name);
+
+    if (std::strcmp(name, CommandBatchNP.getName()) == 0) {
+        CommandBatchNP.update(values, names, n);
+        CommandBatchNP.setState(IPS_OK);
+        CommandBatchNP.apply();
+        saveConfig(true, CommandBatchNP.getName());
+        return true;
+    }
+
+    if (std::strcmp(name, RotationSettingsNP.getName()) == 0) {
+        RotationSettingsNP.update(values, names, n);
+        RotationSettingsNP.setState(IPS_OK);
+        RotationSettingsNP.apply();
+        saveConfig(true, RotationSettingsNP.getName());
+        return true;
+    }
+
+    if (std::strcmp(name, PecSettingsNP.getName()) == 0) {
+        PecSettingsNP.update(values, names, n);
+        PecSettingsNP.setState(IPS_OK);
+        PecSettingsNP.apply();
+        saveConfig(true, PecSettingsNP.getName());
+        return true;
+    }
     
     // Pass it up the chain
     return INDI::Telescope::ISNewNumber(dev, name, values, names, n);
@@ -185,6 +363,56 @@ bool BenroPolaris::ISNewNumber(const char *dev, const char *name, double values[
 bool BenroPolaris::ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int n) {
     LOGF_INFO("ISNewSwitch: %s", name);
 
+    if (std::strcmp(name, PecControlSP.getName()) == 0) {
+        PecControlSP.update(states, names, n);
+        PecControlSP.setState(IPS_OK);
+
+        if (PecControlSP[PEC_ANALYZE].getState() == ISS_ON) {
+            PecControlSP[PEC_ANALYZE].setState(ISS_OFF);
+            if (pec.Analyze(static_cast<size_t>(PecSettingsNP[PEC_TERMS].getValue()))) {
+                if (pec.IsAnalyzed()) {
+                    LOGF_INFO("PEC analysis done, dominant period %.1fs, RMS %.2f\", fit residual %.2f\"",
+                              pec.GetDominantPeriod(), pec.GetRawRMS(), pec.GetFitRMS());
+                } else {
+                    LOGF_INFO("No periodic error above the noise floor, RMS %.2f\"", pec.GetRawRMS());
+                }
+                SavePECState();
+            } else {
+                LOGF_WARN("PEC analysis failed, %d samples recorded", static_cast<int>(pec.GetSampleCount()));
+                PecControlSP.setState(IPS_ALERT);
+            }
+        } else if (PecControlSP[PEC_CLEAR].getState() == ISS_ON) {
+            PecControlSP[PEC_CLEAR].setState(ISS_OFF);
+            pec.Clear();
+            SavePECState();
+            PECStateSP[PEC_ON].setState(ISS_OFF);
+            PECStateSP[PEC_OFF].setState(ISS_ON);
+            PECStateSP.apply();
+        } else if (PecControlSP[PEC_RECORD].getState() == ISS_ON) {
+            LOG_INFO("Recording tracking residuals, keep the mount tracking for a few worm periods");
+            PecControlSP.setState(IPS_BUSY);
+        }
+
+        PecControlSP.apply();
+        UpdatePECStats();
+        return true;
+    }
+
+    if (std::strcmp(name, PECStateSP.getName()) == 0) {
+        PECStateSP.update(states, names, n);
+        PECStateSP.setState(IPS_OK);
+        if (PECStateSP[PEC_ON].getState() == ISS_ON && !pec.IsAnalyzed()) {
+            LOG_WARN("No PEC model available, record and analyze tracking residuals first");
+            PECStateSP[PEC_ON].setState(ISS_OFF);
+            PECStateSP[PEC_OFF].setState(ISS_ON);
+            PECStateSP.setState(IPS_ALERT);
+        }
+        pecAppliedAz = 0;
+        pecAppliedAlt = 0;
+        PECStateSP.apply();
+        return true;
+    }
+
     // Pass it up the chain
     return INDI::Telescope::ISNewSwitch(dev, name, states, names, n);
 }
@@ -197,11 +425,45 @@ bool BenroPolaris::ISNewText(const char *dev, const char *name, char *texts[], c
 
     if (std::strcmp(name, CommandTP.getName()) == 0) {
         if (std::strlen(texts[REQUEST]) > 0 && strcasecmp(texts[REQUEST], CommandTP[REQUEST].getText()) != 0) {
-            WriteRequest(texts[REQUEST]);
+            // diagnostic traffic stays out of the round trip that times 518 samples
+            WriteRequest(texts[REQUEST], true, 3, false);
         }
         if (std::strlen(texts[RESPONSE]) > 0 && strcasecmp(texts[RESPONSE], CommandTP[RESPONSE].getText()) != 0) {
-            StoreResponseAndUpdateState(DecodeResponse(texts[RESPONSE]));
+            StoreResponseAndUpdateState(DecodeResponse(texts[RESPONSE]), ln_get_julian_from_sys());
+        }
+    }
+
+    if (std::strcmp(name, CommandBatchTP.getName()) == 0) {
+        if (!batchCommands.empty()) {
+            LOG_WARN("A command batch is still running");
+            CommandBatchTP.setState(IPS_ALERT);
+            CommandBatchTP.apply();
+            return true;
+        }
+        CommandBatchTP.update(texts, names, n);
+
+        std::string frames = CommandBatchTP[BATCH_FRAMES].getText();
+        const std::string script = CommandBatchTP[BATCH_SCRIPT].getText();
+        if (frames.empty() && !script.empty()) {
+            std::ifstream file(script);
+            if (!file) {
+                LOGF_ERROR("Cannot read command script %s", script.c_str());
+                CommandBatchTP.setState(IPS_ALERT);
+                CommandBatchTP.apply();
+                return true;
+            }
+            std::stringstream content;
+            content << file.rdbuf();
+            frames = content.str();
         }
+
+        std::string output = CommandBatchTP[BATCH_OUTPUT].getText();
+        if (output.empty()) {
+            const char *home = getenv("HOME");
+            output = std::string(home != nullptr ? home : ".") + "/.indi/" + getDeviceName() + "_batch.txt";
+        }
+        StartCommandBatch(ParseCommandFrames(frames), output);
+        return true;
     }
 
     // Pass it up the chain
@@ -216,11 +478,26 @@ bool BenroPolaris::ISNewText(const char *dev, const char *name, char *texts[], c
  ** INDI wants us to connect to the telescope
  ***************************************************************************************/
 bool BenroPolaris::Connect() {
+    // reset before the handshake, its requests are already timed and may lose the link
+    receiveBuffer.clear();
+    pendingRequests.clear();
+    lastFrameJd = ln_get_julian_from_sys();
+    lastPoseJd = 0;
+    linkLost = false;
+    linkResuming = false;
+    linkPendingAbort = false;
+    linkPendingTrackOff = false;
+    smoothedRoundTrip = stateFile.Get() != nullptr ? stateFile.Get()->roundTrip : 0;
+    minRoundTrip = stateFile.Get() != nullptr ? stateFile.Get()->minRoundTrip : 0;
+
     const bool connected = INDI::Telescope::Connect();
     if (connected) {
-        readResponseCallback = IEAddCallback(PortFD, [](int fileRef, void* instance) {
-            static_cast<BenroPolaris*>(instance)->ReadResponses(fileRef);
-        }, this);
+        // a link lost during the handshake registers the callback once reconnected
+        if (!linkLost) {
+            readResponseCallback = IEAddCallback(PortFD, [](int fileRef, void* instance) {
+                static_cast<BenroPolaris*>(instance)->ReadResponses(fileRef);
+            }, this);
+        }
 
         SetTimer(KEEPALIVE_PERIOD);
     }
@@ -234,7 +511,21 @@ bool BenroPolaris::Disconnect() {
     const bool disconnected = INDI::Telescope::Disconnect();
     if (disconnected) {
         // IERmTimer(keepaliveTimer);
-        IERmCallback(readResponseCallback);
+        if (readResponseCallback >= 0) {
+            IERmCallback(readResponseCallback);
+            readResponseCallback = -1;
+        }
+        if (reconnectThread.joinable()) {
+            reconnectThread.join();
+        }
+        if (reconnectFd >= 0) {
+            close(reconnectFd);
+            reconnectFd = -1;
+        }
+        linkLost = false;
+        linkResuming = false;
+        poseFilter.Reset();
+        stateFile.Flush();
     }
     return disconnected;
 }
@@ -247,33 +538,45 @@ bool BenroPolaris::Handshake() {
 
     bool fakeDevice = true;
     if (!isSimulation()) {
+        // let the kernel stamp inbound frames, so event loop queueing doesn't delay poses
+        int enable = 1;
+        if (setsockopt(PortFD, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable)) != 0) {
+            LOGF_WARN("Kernel receive timestamps unavailable (%s), using processing time", strerror(errno));
+        }
+
         WriteRequest(EncodeRequest(CMD_284_MODE, 2));
 
+        // without an answer yet, trust the mode of the last run, 284 confirms it in the background
+        std::map<std::string, std::string> modeResponse;
+        const PolarisState *state = stateFile.Get();
+        modeFromCache = false;
+        astroMode = true;
         if (responses.find(CMD_284_MODE) != responses.end()) {
-            std::string mode = responses[CMD_284_MODE].first["mode"];
-            std::string track = responses[CMD_284_MODE].first["track"];
+            modeResponse = responses[CMD_284_MODE].first;
+        } else if (state != nullptr && state->mode != 0) {
+            modeFromCache = true;
+            LOGF_INFO("Using cached mode %d track %d until the mount confirms", state->mode, state->track);
+            modeResponse["mode"] = std::to_string(state->mode);
+            modeResponse["track"] = std::to_string(state->track);
+        }
+
+        if (!modeResponse.empty()) {
+            std::string mode = modeResponse["mode"];
+            std::string track = modeResponse["track"];
             
-            if (mode == "8") {
-                if (track == "3") {
-                    WriteRequest(EncodeRequest(CMD_808_CONNECTION, 2, {{"type", "0"}}));
-                    WriteRequest(EncodeRequest(CMD_520_POSITION, 2, {{"state", "1"}}));
-                    
-                    // // TODO: later
-                    // # if we want to run Aim test or Drift test over a set of targets in the sky
-                    // if Config.log_performance_data_test == 1 or Config.log_performance_data_test == 2:
-                    //     asyncio.create_task(self.goto_tracking_test())
-                    // # if we want to run Speed test to ramp moveaxis rate over its full range
-                    // if Config.log_performance_data == 3 and Config.log_performance_data_test == 3:
-                    //     asyncio.create_task(self.moveaxis_ramp_speed_test())
+            if (ValidateMode(mode, track, true)) {
+                WriteRequest(EncodeRequest(CMD_808_CONNECTION, 2, {{"type", "0"}}));
+                WriteRequest(EncodeRequest(CMD_520_POSITION, 2, {{"state", "1"}}));
+                
+                // // TODO: later
+                // # if we want to run Aim test or Drift test over a set of targets in the sky
+                // if Config.log_performance_data_test == 1 or Config.log_performance_data_test == 2:
+                //     asyncio.create_task(self.goto_tracking_test())
+                // # if we want to run Speed test to ramp moveaxis rate over its full range
+                // if Config.log_performance_data == 3 and Config.log_performance_data_test == 3:
+                //     asyncio.create_task(self.moveaxis_ramp_speed_test())
 
-                } else {
-                    LOGF_INFO("Invalid track %s, expected 3", track.c_str());
-                    LOG_ERROR("Polaris is not aligned and tracking, please use app to do a basic alignment and reconnect driver");
-                    return fakeDevice;
-                }
             } else {
-                LOGF_INFO("Invalid mode %s, expected 8", mode.c_str());
-                LOG_ERROR("Polaris is not in astro mode, please use app to switch to astro mode and reconnect driver");
                 return fakeDevice;
             }
         } else {
@@ -285,6 +588,27 @@ bool BenroPolaris::Handshake() {
     return true;
 }
 
+/**************************************************************************************
+ ** Whether the head is in astro mode (8) and aligned and tracking (3), logging why not
+ ***************************************************************************************/
+bool BenroPolaris::ValidateMode(const std::string &mode, const std::string &track, bool report) {
+    if (mode != "8") {
+        if (report) {
+            LOGF_INFO("Invalid mode %s, expected 8", mode.c_str());
+            LOG_ERROR("Polaris is not in astro mode, please use app to switch to astro mode and reconnect driver");
+        }
+        return false;
+    }
+    if (track != "3") {
+        if (report) {
+            LOGF_INFO("Invalid track %s, expected 3", track.c_str());
+            LOG_ERROR("Polaris is not aligned and tracking, please use app to do a basic alignment and reconnect driver");
+        }
+        return false;
+    }
+    return true;
+}
+
 /**************************************************************************************
  ** Client is asking us to report telescope status
  ***************************************************************************************/
@@ -309,20 +633,35 @@ bool BenroPolaris::ReadScopeStatus() {
 /**************************************************************************************
  ** Write a request to the telescope
  ***************************************************************************************/
-void BenroPolaris::WriteRequest(std::string request, bool readResponse, int retries) {
+bool BenroPolaris::WriteRequest(std::string request, bool readResponse, int retries, bool timed) {
+    if (linkLost) {
+        LOGF_DEBUG("Link down, dropping request: %s", request.c_str());
+        return false;
+    }
+
     int errorCode = 0;
     int bytesWritten = 0;
     if ((errorCode = tty_write_string(PortFD, request.c_str(), &bytesWritten)) != TTY_OK) {
         if (retries > 0) {
-            WriteRequest(request, readResponse,  - 1);
-        } else {
-            LOGF_ERROR("Failed to send request '%s' with error %d", request.c_str(), errorCode);
-            setConnected(false);
+            return WriteRequest(request, readResponse,  - 1, timed);
         }
+        LOGF_ERROR("Failed to send request '%s' with error %d", request.c_str(), errorCode);
+        LinkLost("write failed", ln_get_julian_from_sys());
+        return false;
+    }
+    if (timed) {
+        // requests whose answer never came (or comes under another code) expire here
+        const double jd = ln_get_julian_from_sys();
+        std::deque<double> &sent = pendingRequests[DecodeRequestCommand(request)];
+        while (!sent.empty() && (jd - sent.front()) * SECONDS_PER_DAY > LATENCY_MAX_ROUND_TRIP) {
+            sent.pop_front();
+        }
+        sent.push_back(jd);
     }
     
     LOGF_INFO("Sent request: %s", request.c_str());
     tcflush(PortFD, TCIFLUSH);
+    return true;
 }
 
 /**************************************************************************************
@@ -333,20 +672,106 @@ void BenroPolaris::ReadResponses(int fileRef) {
         LOGF_WARN("Different file reference %d vs %d", fileRef, PortFD);
     }
 
-    int errorCode = 0;
-    do {
-        int bytesRead = 0;
-        char response[256];
+    char buffer[1024];
+    char control[CMSG_SPACE(sizeof(struct timeval))];
+    while (true) {
+        struct iovec iov { buffer, sizeof(buffer) };
+        struct msghdr message {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        const ssize_t bytesRead = recvmsg(PortFD, &message, MSG_DONTWAIT);
+        if (bytesRead == 0) {
+            LinkLost("connection closed by the mount", ln_get_julian_from_sys());
+            return;
+        }
+        if (bytesRead < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LinkLost(strerror(errno), ln_get_julian_from_sys());
+            }
+            return;
+        }
 
-        if ((errorCode = tty_read_section(PortFD, response, '#', 1, &bytesRead)) == TTY_OK) {
-            response[bytesRead] = '\0';
-            // LOGF_INFO("Response: %s", response);
-            StoreResponseAndUpdateState(DecodeResponse(response));
+        // frames completed by this read are stamped with the kernel receive time
+        double receivedJd = ln_get_julian_from_sys();
+        for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMP) {
+                struct timeval stamp;
+                std::memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+                receivedJd = UNIX_EPOCH_JD + (stamp.tv_sec + stamp.tv_usec / 1e6) / SECONDS_PER_DAY;
+            }
+        }
+
+        receiveBuffer.append(buffer, bytesRead);
+        size_t frameEnd;
+        while ((frameEnd = receiveBuffer.find('#')) != std::string::npos) {
+            const std::string response = receiveBuffer.substr(0, frameEnd + 1);
+            receiveBuffer.erase(0, frameEnd + 1);
+            // LOGF_INFO("Response: %s", response.c_str());
+            lastFrameJd = receivedJd;
+            // responses claimed by a batch don't answer the driver's own requests
+            if (!MatchBatchResponse(response, receivedJd)) {
+                UpdateRoundTrip(std::atoi(response.c_str()), receivedJd);
+            }
+            StoreResponseAndUpdateState(DecodeResponse(response), receivedJd);
         }
-    } while (errorCode == TTY_OK);
+        if (receiveBuffer.size() > RECEIVE_BUFFER_MAX) {
+            LOG_WARN("Dropping unterminated response data");
+            receiveBuffer.clear();
+        }
+    }
 }
 
-void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::string, std::string>> decodedResponse) {
+/**************************************************************************************
+ ** Match a response to its request and update the transport delay estimate
+ ***************************************************************************************/
+void BenroPolaris::UpdateRoundTrip(int command, double receivedJd) {
+    const auto pending = pendingRequests.find(command);
+    if (pending == pendingRequests.end()) {
+        return;
+    }
+
+    // the oldest outstanding request is answered first, expired ones lost their response
+    std::deque<double> &sent = pending->second;
+    while (!sent.empty() && (receivedJd - sent.front()) * SECONDS_PER_DAY > LATENCY_MAX_ROUND_TRIP) {
+        sent.pop_front();
+    }
+    if (sent.empty()) {
+        return;
+    }
+    const double roundTrip = (receivedJd - sent.front()) * SECONDS_PER_DAY;
+    sent.pop_front();
+    if (roundTrip < 0) {
+        return;
+    }
+
+    smoothedRoundTrip = smoothedRoundTrip > 0
+        ? smoothedRoundTrip + LATENCY_SMOOTHING * (roundTrip - smoothedRoundTrip)
+        : roundTrip;
+    minRoundTrip = minRoundTrip > 0 ? std::min(minRoundTrip, roundTrip) : roundTrip;
+
+    LatencyNP[LATENCY_RTT].setValue(smoothedRoundTrip * 1000.);
+    LatencyNP[LATENCY_RTT_MIN].setValue(minRoundTrip * 1000.);
+    LatencyNP[LATENCY_DELAY].setValue(smoothedRoundTrip * 500.);
+    LatencyNP.setState(IPS_OK);
+    LatencyNP.apply();
+
+    if (PolarisState *state = stateFile.Get()) {
+        state->roundTrip = smoothedRoundTrip;
+        state->minRoundTrip = minRoundTrip;
+    }
+}
+
+/**************************************************************************************
+ ** When the mount sampled a frame we received at the given time
+ ***************************************************************************************/
+double BenroPolaris::GetSampleTime(double receivedJd) const {
+    return receivedJd - smoothedRoundTrip / 2. / SECONDS_PER_DAY;
+}
+
+void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::string, std::string>> decodedResponse, double receivedJd) {
     const int code = decodedResponse.first;
     std::string dataString = "";
     responses[code] = std::make_pair(decodedResponse.second, std::chrono::system_clock::now().time_since_epoch().count());
@@ -358,24 +783,74 @@ void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::stri
     switch (code) {
         case CMD_284_MODE:
             // 284@mode:8;state:0;track:3;speed:0;halfSpeed:0;remNum:;runTime:;photoNum:;pause:;interval:;repeNum:;#
-
+            {
+                // the first answer must back what a cached handshake assumed, later ones only the mode
+                const std::string mode = decodedResponse.second["mode"];
+                const std::string track = modeFromCache ? decodedResponse.second["track"] : "3";
+                const bool valid = ValidateMode(mode, track, false);
+                if (!valid && (modeFromCache || astroMode)) {
+                    if (modeFromCache) {
+                        const PolarisState *state = stateFile.Get();
+                        LOGF_ERROR("Mount reports mode %s track %s, session was started on cached mode %d track %d",
+                                   mode.c_str(), decodedResponse.second["track"].c_str(),
+                                   state != nullptr ? state->mode : 0, state != nullptr ? state->track : 0);
+                    }
+                    ValidateMode(mode, track, true);
+                    if (parkStage == PARK_STAGE_NONE) {
+                        TrackState = SCOPE_IDLE;
+                    }
+                    trackingTargetValid = false;
+                    TrackStateSP.setState(IPS_ALERT);
+                    TrackStateSP.apply();
+                    EqNP.setState(IPS_ALERT);
+                    EqNP.apply();
+                } else if (valid && !astroMode) {
+                    LOG_INFO("Polaris is back in astro mode");
+                }
+                astroMode = valid;
+                modeFromCache = false;
+            }
+            if (PolarisState *state = stateFile.Get()) {
+                const int mode = std::atoi(decodedResponse.second["mode"].c_str());
+                if (state->mode != 0 && state->mode != mode) {
+                    LOGF_WARN("Mount mode changed from %d to %d since last run", state->mode, mode);
+                }
+                state->mode = mode;
+                state->track = std::atoi(decodedResponse.second["track"].c_str());
+            }
             break;
 
-        case CMD_518_AHRS:
+        case CMD_518_AHRS: {
             // 518@w:0.4402258;x:-0.5703645;y:-0.5810719;z:-0.3784723;w:-0.3784722;x:-0.5703645;y:-0.5810719;z:-0.4402257;compass:175.1536255;alt:-19.0213356;#
-            INDI::IHorizontalCoordinates AltAz { std::stof(decodedResponse.second["alt"]), std::stof(decodedResponse.second["compass"]) };
-            if (std::abs(AltAzNP[ALT].getValue() - AltAz.altitude) > 0.001 ||
-                std::abs(AltAzNP[AZM].getValue() - AltAz.azimuth) > 0.001) {
-                INDI::IEquatorialCoordinates Eq { 0, 0 };
-                INDI::HorizontalToEquatorial(&AltAz, &m_Location, ln_get_julian_from_sys(), &Eq);
-                
-                AltAzNP[AZM].setValue(AltAz.azimuth);
-                AltAzNP[ALT].setValue(AltAz.altitude);
-                AltAzNP.apply();
-
-                NewRaDec(Eq.rightascension, Eq.declination);
+            const double jd = GetSampleTime(receivedJd);
+            INDI::IHorizontalCoordinates AltAz { 0, 0 };
+            AltAz.azimuth = std::stod(decodedResponse.second["compass"]);
+            AltAz.altitude = std::stod(decodedResponse.second["alt"]);
+            // raw samples, fast park motion would mostly be rejected by the filter gate
+            TrackParkMotion(AltAz, jd);
+            if (!poseFilter.Update(jd, AltAz.azimuth, AltAz.altitude)) {
+                LOGF_DEBUG("Rejected pose Az %f Alt %f, innovation %.1f",
+                           AltAz.azimuth, AltAz.altitude, poseFilter.GetLastInnovation());
+                break;
+            }
+            lastPoseJd = receivedJd;
+            if (linkResuming) {
+                ResumeSession(jd);
+            }
+            RecordTrackingResidual(AltAz, jd);
+
+            INDI::IHorizontalCoordinates estimate { 0, 0 };
+            if (GetPredictedPose(jd, estimate)) {
+                PublishPose(estimate, jd);
+                UpdateFieldRotation(estimate);
+                if (PolarisState *state = stateFile.Get()) {
+                    state->poseJd = jd;
+                    state->poseAz = estimate.azimuth;
+                    state->poseAlt = estimate.altitude;
+                }
             }
             break;
+        }
         case CMD_519_GOTO:
             // 519@ret:1;track:0;#
             // 519@ret:0;track:0;#
@@ -390,8 +865,13 @@ void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::stri
             break;
         case CMD_531_TRACK:
             // 531@ret:3;#
+            if (parkStage != PARK_STAGE_NONE) {
+                // the track-off sent by Park(), the park stages own TrackState until settled
+                break;
+            }
             if (decodedResponse.second["ret"] == "0") {
                 TrackState = SCOPE_IDLE;
+                trackingTargetValid = false;
             } else {
                 TrackState = SCOPE_TRACKING;
             }
@@ -404,7 +884,23 @@ void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::stri
             DeviceInfoTP[ASTRO_MODULE_VERSION].setText(decodedResponse.second["exAxis"].c_str());
             DeviceInfoTP[SV].setText(decodedResponse.second["sv"].c_str());
             DeviceInfoTP[OV].setText(decodedResponse.second["ov"].c_str());
+            DeviceInfoTP.setState(IPS_OK);
             DeviceInfoTP.apply();
+
+            if (PolarisState *state = stateFile.Get()) {
+                if (state->softwareVersion[0] != '\0' && decodedResponse.second["sw"] != state->softwareVersion) {
+                    LOGF_WARN("Mount firmware changed from %s to %s, discarding cached PEC model",
+                              state->softwareVersion, decodedResponse.second["sw"].c_str());
+                    pec.Clear();
+                    SavePECState();
+                    UpdatePECStats();
+                }
+                snprintf(state->hardwareVersion, sizeof(state->hardwareVersion), "%s", decodedResponse.second["hw"].c_str());
+                snprintf(state->softwareVersion, sizeof(state->softwareVersion), "%s", decodedResponse.second["sw"].c_str());
+                snprintf(state->astroModuleVersion, sizeof(state->astroModuleVersion), "%s", decodedResponse.second["exAxis"].c_str());
+                snprintf(state->sv, sizeof(state->sv), "%s", decodedResponse.second["sv"].c_str());
+                snprintf(state->ov, sizeof(state->ov), "%s", decodedResponse.second["ov"].c_str());
+            }
             break;
         
         case CMD_775_STORAGE:
@@ -414,6 +910,12 @@ void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::stri
             StorageNP[USED].setValue(std::stof(decodedResponse.second["usespace"]));
             StorageNP.setState(decodedResponse.second["status"] == "1" ? IPS_OK : IPS_ALERT);
             StorageNP.apply();
+
+            if (PolarisState *state = stateFile.Get()) {
+                state->storageTotal = StorageNP[TOTAL].getValue();
+                state->storageFree = StorageNP[FREE].getValue();
+                state->storageUsed = StorageNP[USED].getValue();
+            }
             break;
         
         case CMD_778_BATTERY:
@@ -421,6 +923,10 @@ void BenroPolaris::StoreResponseAndUpdateState(std::pair<int, std::map<std::stri
             BatteryNP[CAPACITY].setValue(std::stof(decodedResponse.second["capacity"]));
             BatteryNP.setState(decodedResponse.second["charge"] == "1" ? IPS_OK : IPS_IDLE);
             BatteryNP.apply();
+
+            if (PolarisState *state = stateFile.Get()) {
+                state->batteryCapacity = BatteryNP[CAPACITY].getValue();
+            }
             break;
         
         case CMD_525_UNKNOWN:
@@ -468,6 +974,14 @@ std::string BenroPolaris::EncodeRequest(int command, int type, std::string data)
     return request;
 }
 
+/**************************************************************************************
+ ** Decode the command code of a request, 1&<command>&<type>&<data>#
+ ***************************************************************************************/
+int BenroPolaris::DecodeRequestCommand(const std::string &request) {
+    const size_t commandStart = request.find('&');
+    return commandStart != std::string::npos ? std::atoi(request.c_str() + commandStart + 1) : -1;
+}
+
 /**************************************************************************************
  ** Decode Response
  ***************************************************************************************/
@@ -494,6 +1008,362 @@ std::pair<int, std::map<std::string, std::string>> BenroPolaris::DecodeResponse(
     return std::make_pair(-1, std::map<std::string, std::string>());
 }
 
+/////////////////////////////////////////////////////////////////////////////////////
+/// Link Recovery
+/////////////////////////////////////////////////////////////////////////////////////
+
+/**************************************************************************************
+ ** Seconds without any frame after which the link is considered dead
+ ***************************************************************************************/
+double BenroPolaris::GetLinkTimeout() const {
+    return std::max(LINK_MIN_TIMEOUT, LINK_ROUND_TRIP_FACTOR * smoothedRoundTrip);
+}
+
+/**************************************************************************************
+ ** Heartbeat, declares the link dead when frames stop and drives the reconnect
+ ***************************************************************************************/
+void BenroPolaris::CheckLinkHealth(double jd) {
+    if (linkLost) {
+        if (reconnectDone) {
+            FinishReconnect(jd);
+        } else if (!reconnectThread.joinable() && jd >= linkRetryJd) {
+            StartReconnect();
+        }
+        return;
+    }
+
+    const double age = (jd - lastFrameJd) * SECONDS_PER_DAY;
+    const double timeout = GetLinkTimeout();
+    LinkNP[LINK_AGE].setValue(std::max(age, 0.));
+    LinkNP[LINK_TIMEOUT].setValue(timeout);
+    if (!linkResuming) {
+        LinkNP.setState(IPS_OK);
+    }
+    LinkNP.apply();
+
+    if (age > timeout) {
+        char reason[64];
+        snprintf(reason, sizeof(reason), "no frames for %.1f s", age);
+        LinkLost(reason, jd);
+    }
+}
+
+/**************************************************************************************
+ ** Stop using the socket and reconnect in the background, the device stays connected
+ ***************************************************************************************/
+void BenroPolaris::LinkLost(const char *reason, double jd) {
+    if (linkLost) {
+        return;
+    }
+    LOGF_WARN("Link to the mount lost (%s), reconnecting in the background", reason);
+
+    linkLost = true;
+    linkResuming = false;
+    linkLostJd = jd;
+    linkLastFrameJd = lastFrameJd;
+    linkAttempts = 0;
+    linkDropouts++;
+    if (readResponseCallback >= 0) {
+        IERmCallback(readResponseCallback);
+        readResponseCallback = -1;
+    }
+    shutdown(PortFD, SHUT_RDWR);
+    stateFile.Flush();
+
+    LinkNP[LINK_DROPOUTS].setValue(linkDropouts);
+    LinkNP.setState(IPS_BUSY);
+    LinkNP.apply();
+    StartReconnect();
+}
+
+/**************************************************************************************
+ ** Connect a fresh socket on a worker thread, the event loop keeps running meanwhile
+ ***************************************************************************************/
+void BenroPolaris::StartReconnect() {
+    if (tcpConnection == nullptr) {
+        return;
+    }
+    if (reconnectThread.joinable()) {
+        reconnectThread.join();
+    }
+
+    // never drop a socket a previous attempt connected
+    const int stale = reconnectFd.exchange(-1);
+    if (stale >= 0) {
+        close(stale);
+    }
+
+    linkAttempts++;
+    reconnectDone = false;
+    const std::string host = tcpConnection->host();
+    const uint32_t port = tcpConnection->port();
+    reconnectThread = std::thread([this, host, port]() {
+        reconnectFd = OpenSocket(host, port);
+        reconnectDone = true;
+    });
+}
+
+/**************************************************************************************
+ ** Swap the new socket in place of the dead one and resume the session
+ ***************************************************************************************/
+void BenroPolaris::FinishReconnect(double jd) {
+    reconnectThread.join();
+    reconnectDone = false;
+
+    const int fd = reconnectFd.exchange(-1);
+    if (fd < 0) {
+        LOGF_DEBUG("Reconnect attempt %d failed, retrying", linkAttempts);
+        linkRetryJd = jd + LINK_RETRY_PERIOD / SECONDS_PER_DAY;
+        return;
+    }
+
+    // keep the descriptor number, so the TCP connection plugin still owns and closes it
+    if (dup2(fd, PortFD) < 0) {
+        LOGF_WARN("Cannot replace socket (%s), retrying", strerror(errno));
+        close(fd);
+        linkRetryJd = jd + LINK_RETRY_PERIOD / SECONDS_PER_DAY;
+        return;
+    }
+    close(fd);
+
+    int enable = 1;
+    setsockopt(PortFD, SOL_SOCKET, SO_TIMESTAMP, &enable, sizeof(enable));
+    receiveBuffer.clear();
+    pendingRequests.clear();
+    lastFrameJd = jd;
+    readResponseCallback = IEAddCallback(PortFD, [](int fileRef, void* instance) {
+        static_cast<BenroPolaris*>(instance)->ReadResponses(fileRef);
+    }, this);
+
+    // the mount still knows mode and alignment, only the session and pose stream need restarting
+    LOGF_INFO("Link restored after %d attempt(s), resuming session", linkAttempts);
+    linkLost = false;
+    linkResuming = true;
+    if (linkPendingAbort) {
+        LOG_INFO("Sending the abort requested while the link was down");
+        linkPendingAbort = !SendStop();
+        linkPendingTrackOff = false;
+    }
+    if (linkPendingTrackOff) {
+        LOG_INFO("Sending the tracking stop requested while the link was down");
+        linkPendingTrackOff = !WriteRequest(EncodeRequest(CMD_531_TRACK, 3, {{"state", "0"}, {"speed", "0"}}));
+    }
+    WriteRequest(EncodeRequest(CMD_808_CONNECTION, 2, {{"type", "0"}}));
+    WriteRequest(EncodeRequest(CMD_520_POSITION, 2, {{"state", "1"}}));
+}
+
+/**************************************************************************************
+ ** First pose after a reconnect, put tracking back on target and report the outage, from
+ ** the last frame before it, and the recovery, from the moment it was detected
+ ***************************************************************************************/
+void BenroPolaris::ResumeSession(double jd) {
+    linkResuming = false;
+    const double outage = (lastPoseJd - linkLastFrameJd) * SECONDS_PER_DAY;
+    const double recovery = (lastPoseJd - linkLostJd) * SECONDS_PER_DAY;
+
+    // re-point at the locked target, differential drift of the outage follows on the next tick
+    if (TrackState == SCOPE_TRACKING && trackingTargetValid) {
+        INDI::IHorizontalCoordinates target { 0, 0 };
+        INDI::EquatorialToHorizontal(&trackingTarget, &m_Location, jd, &target);
+        SendGoto(target, true);
+        pecAppliedAz = 0;
+        pecAppliedAlt = 0;
+    }
+
+    LOGF_INFO("Session resumed after a %.1f s outage, %.1f s after it was detected", outage, recovery);
+    LinkNP[LINK_OUTAGE].setValue(outage);
+    LinkNP[LINK_RECOVERY].setValue(recovery);
+    LinkNP.setState(IPS_OK);
+    LinkNP.apply();
+}
+
+/**************************************************************************************
+ ** Blocking TCP connect with a timeout, runs on the reconnect thread
+ ***************************************************************************************/
+int BenroPolaris::OpenSocket(const std::string &host, uint32_t port) {
+    struct addrinfo hints {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address != nullptr && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        // connect() honours the send timeout on Linux
+        struct timeval timeout { static_cast<time_t>(LINK_CONNECT_TIMEOUT), 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Command Batches
+/////////////////////////////////////////////////////////////////////////////////////
+
+/**************************************************************************************
+ ** Split text into '#' terminated frames, lines starting with // are comments
+ ***************************************************************************************/
+std::vector<std::string> BenroPolaris::ParseCommandFrames(const std::string &text) {
+    std::string content;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        const size_t start = line.find_first_not_of(" \t\r");
+        if (start != std::string::npos && line.compare(start, 2, "//") != 0) {
+            content += line.substr(start) + "\n";
+        }
+    }
+
+    std::vector<std::string> frames;
+    size_t start = 0, end;
+    while ((end = content.find('#', start)) != std::string::npos) {
+        std::string frame = content.substr(start, end - start);
+        frame.erase(0, frame.find_first_not_of(" \t\r\n"));
+        if (!frame.empty()) {
+            frames.push_back(frame + "#");
+        }
+        start = end + 1;
+    }
+    return frames;
+}
+
+/**************************************************************************************
+ ** Pipeline the frames to the mount, spaced by BATCH_SPACING
+ ***************************************************************************************/
+void BenroPolaris::StartCommandBatch(const std::vector<std::string> &frames, const std::string &output) {
+    if (frames.empty()) {
+        LOG_WARN("No '#' terminated frames in command batch");
+        CommandBatchTP.setState(IPS_ALERT);
+        CommandBatchTP.apply();
+        return;
+    }
+
+    batchCommands.clear();
+    for (const auto &frame : frames) {
+        batchCommands.push_back({ frame, DecodeRequestCommand(frame), 0, 0, "" });
+    }
+    batchNext = 0;
+    batchOutput = output;
+
+    LOGF_INFO("Running batch of %d commands", static_cast<int>(batchCommands.size()));
+    CommandBatchTP.setState(IPS_BUSY);
+    CommandBatchTP.apply();
+    RunCommandBatch();
+}
+
+/**************************************************************************************
+ ** Send the next frame of the batch, or finish once the responses are in or timed out
+ ***************************************************************************************/
+void BenroPolaris::RunCommandBatch() {
+    batchTimer = -1;
+    if (batchCommands.empty()) {
+        return;
+    }
+
+    const double jd = ln_get_julian_from_sys();
+    if (batchNext < batchCommands.size()) {
+        if (!isConnected() || linkLost) {
+            LOG_ERROR("Connection lost, command batch aborted");
+            FinishCommandBatch();
+            return;
+        }
+        WriteRequest(batchCommands[batchNext].request, true, 3, false);
+        batchCommands[batchNext].sentJd = jd;
+        batchNext++;
+    } else if ((jd - batchCommands.back().sentJd) * SECONDS_PER_DAY * 1000. > CommandBatchNP[BATCH_TIMEOUT].getValue()) {
+        FinishCommandBatch();
+        return;
+    }
+
+    const int delay = batchNext < batchCommands.size()
+        ? static_cast<int>(CommandBatchNP[BATCH_SPACING].getValue())
+        : BATCH_POLL_PERIOD;
+    batchTimer = IEAddTimer(delay, [](void *instance) {
+        static_cast<BenroPolaris*>(instance)->RunCommandBatch();
+    }, this);
+}
+
+/**************************************************************************************
+ ** Match a response to the oldest unanswered batch request with the same command, false
+ ** if it belongs to the driver
+ ***************************************************************************************/
+bool BenroPolaris::MatchBatchResponse(const std::string &response, double receivedJd) {
+    if (batchCommands.empty()) {
+        return false;
+    }
+
+    const int command = std::atoi(response.c_str());
+    bool pending = false;
+    bool matched = false;
+    for (size_t i = 0; i < batchNext; i++) {
+        BatchCommand &entry = batchCommands[i];
+        if (!matched && entry.receivedJd == 0 && entry.command == command) {
+            entry.receivedJd = receivedJd;
+            entry.response = response;
+            matched = true;
+        }
+        pending |= entry.receivedJd == 0;
+    }
+
+    if (matched && !pending && batchNext == batchCommands.size()) {
+        FinishCommandBatch();
+    }
+    return matched;
+}
+
+/**************************************************************************************
+ ** Write request, response and round trip of each batch command to the results file
+ ***************************************************************************************/
+void BenroPolaris::FinishCommandBatch() {
+    if (batchTimer >= 0) {
+        IERmTimer(batchTimer);
+        batchTimer = -1;
+    }
+
+    int answered = 0;
+    std::ofstream file(batchOutput, std::ios::app);
+    file << "# index\tsent (unix s)\tround trip (ms)\trequest\tresponse\n";
+    for (size_t i = 0; i < batchCommands.size(); i++) {
+        const BatchCommand &entry = batchCommands[i];
+        char line[128];
+        if (entry.receivedJd > 0) {
+            answered++;
+            snprintf(line, sizeof(line), "%d\t%.3f\t%.1f\t", static_cast<int>(i),
+                     (entry.sentJd - UNIX_EPOCH_JD) * SECONDS_PER_DAY, (entry.receivedJd - entry.sentJd) * SECONDS_PER_DAY * 1000.);
+        } else {
+            snprintf(line, sizeof(line), "%d\t%.3f\t-\t", static_cast<int>(i), (entry.sentJd - UNIX_EPOCH_JD) * SECONDS_PER_DAY);
+        }
+        file << line << entry.request << "\t" << (entry.receivedJd > 0 ? entry.response : "no response") << "\n";
+    }
+    file.close();
+
+    std::string summary = std::to_string(answered) + "/" + std::to_string(batchCommands.size()) + " answered";
+    if (file) {
+        summary += ", results in " + batchOutput;
+        LOGF_INFO("Command batch done: %s", summary.c_str());
+    } else {
+        summary += ", cannot write results to " + batchOutput;
+        LOGF_ERROR("Command batch done: %s", summary.c_str());
+    }
+    CommandTP[RESPONSE].setText(summary.c_str());
+    CommandTP.apply();
+    CommandBatchTP.setState(file ? IPS_OK : IPS_ALERT);
+    CommandBatchTP.apply();
+    batchCommands.clear();
+    batchNext = 0;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 /// Motion
 /////////////////////////////////////////////////////////////////////////////////////
@@ -527,9 +1397,11 @@ bool BenroPolaris::Goto(double ra, double dec) {
     INDI::IEquatorialCoordinates Eq { ra, dec };
     INDI::IHorizontalCoordinates AltAz { 0, 0 };
 
-    INDI::EquatorialToHorizontal(&Eq, &m_Location, ln_get_julian_from_sys(), &AltAz);
+    const double jd = ln_get_julian_from_sys();
+    INDI::EquatorialToHorizontal(&Eq, &m_Location, jd, &AltAz);
+    LockTrackingTarget(Eq, jd);
 
-    WriteRequest(EncodeRequest(CMD_519_GOTO, 3, {
+    if (!WriteRequest(EncodeRequest(CMD_519_GOTO, 3, {
         {"state", "1"},
         {"yaw", std::to_string(std::round(AltAz.azimuth * 10000) / 10000)},
         {"pitch", std::to_string(std::round(AltAz.altitude * 10000) / 10000)},
@@ -537,7 +1409,11 @@ bool BenroPolaris::Goto(double ra, double dec) {
         {"track", TrackState == SCOPE_TRACKING ? "1" : "0" },
         {"speed", "0"},
         {"lng", std::to_string(std::round(m_Location.longitude * 10000) / 10000)},
-    }));
+    }))) {
+        LOG_ERROR("Goto not sent, link to the mount is down");
+        trackingTargetValid = false;
+        return false;
+    }
     
     LOGF_INFO("NEW GOTO TARGET: Ra %lf Dec %lf - Alt %lf Az %lf", ra, dec, AltAz.altitude, AltAz.azimuth);
     return true;
@@ -557,9 +1433,27 @@ bool BenroPolaris::Sync(double ra, double dec) {
 bool BenroPolaris::Abort() {
     LOG_INFO("Abort");
 
+    const bool sent = SendStop();
+    if (parkStage != PARK_STAGE_NONE) {
+        LOG_WARN("Parking aborted");
+        parkStage = PARK_STAGE_NONE;
+    }
+    TrackState = SCOPE_IDLE;
+    trackingTargetValid = false;
+    if (!sent) {
+        LOG_ERROR("Abort not sent, link to the mount is down, it is sent first once reconnected");
+        linkPendingAbort = linkLost;
+    }
+    return sent;
+}
+
+/**************************************************************************************
+ ** Stop any slew and tracking
+ ***************************************************************************************/
+bool BenroPolaris::SendStop() {
     // cmd = '519'
     // msg = f"1&{cmd}&3&state:0;yaw:0.0;pitch:0.0;lat:{self._sitelatitude:.5f};track:0;speed:0;lng:{self._sitelongitude:.5f};#"
-    WriteRequest(EncodeRequest(CMD_519_GOTO, 3, {
+    return WriteRequest(EncodeRequest(CMD_519_GOTO, 3, {
         {"state", "0"},
         {"yaw", "0.0"},
         {"pitch", "0.0"},
@@ -568,8 +1462,6 @@ bool BenroPolaris::Abort() {
         {"speed", "0"},
         {"lng", std::to_string(std::round(LocationNP[LOCATION_LONGITUDE].getValue() * 10000) / 10000)},
     }));
-    TrackState = SCOPE_IDLE;
-    return true;
 }
 
 /**************************************************************************************
@@ -577,11 +1469,18 @@ bool BenroPolaris::Abort() {
  ***************************************************************************************/
 bool BenroPolaris::SetTrackEnabled(bool enabled) {
     LOGF_INFO("SetTrackEnabled: %s", enabled ? "true" : "false");
+    // the target is locked again from the first pose received while tracking
+    trackingTargetValid = false;
     // cmd = '531'
     // msg = f"1&{cmd}&3&state:{state};speed:0;#"
-    WriteRequest(EncodeRequest(CMD_531_TRACK, 3, {
+    if (!WriteRequest(EncodeRequest(CMD_531_TRACK, 3, {
         { "state", enabled ? "1" : "0" }, { "speed", "0" },
-    }));
+    }))) {
+        LOGF_ERROR("Tracking %s not sent, link to the mount is down", enabled ? "on" : "off");
+        linkPendingTrackOff = !enabled && linkLost;
+        return false;
+    }
+    linkPendingTrackOff = false;
     return true;
 }
 
@@ -590,6 +1489,8 @@ bool BenroPolaris::SetTrackEnabled(bool enabled) {
  ***************************************************************************************/
 bool BenroPolaris::SetTrackMode(uint8_t mode) {
     LOGF_INFO("SetTrackMode: %d", mode);
+    // rates follow TrackModeSP on the next timer hit
+    trackRatesUpdated = 0;
     return true;
 }
 
@@ -598,6 +1499,8 @@ bool BenroPolaris::SetTrackMode(uint8_t mode) {
  ***************************************************************************************/
 bool BenroPolaris::SetTrackRate(double raRate, double deRate) {
     LOGF_INFO("SetTrackRate: %f, %f", raRate, deRate);
+    // rates follow TrackRateNP on the next timer hit
+    trackRatesUpdated = 0;
     return true;
 }
 
@@ -609,14 +1512,20 @@ bool BenroPolaris::SetTrackRate(double raRate, double deRate) {
  ** Client is asking us to park the telescope
  ***************************************************************************************/
 bool BenroPolaris::Park() {
-    if (TrackState == SCOPE_TRACKING) {
-        SetTrackEnabled(false);
+    if (TrackState == SCOPE_TRACKING && !SetTrackEnabled(false)) {
+        return false;
+    }
+    if (!WriteRequest(EncodeRequest(CMD_523_RESET_AXIS, 3, {{"axis", "1"}})) ||
+        !WriteRequest(EncodeRequest(CMD_523_RESET_AXIS, 3, {{"axis", "2"}})) ||
+        !WriteRequest(EncodeRequest(CMD_523_RESET_AXIS, 3, {{"axis", "3"}}))) {
+        LOG_ERROR("Park not sent, link to the mount is down");
+        return false;
     }
-    WriteRequest(EncodeRequest(CMD_523_RESET_AXIS, 3, {{"axis", "1"}}));
-    WriteRequest(EncodeRequest(CMD_523_RESET_AXIS, 3, {{"axis", "2"}}));
-    WriteRequest(EncodeRequest(CMD_523_RESET_AXIS, 3, {{"axis", "3"}}));
 
-    TrackState = SCOPE_PARKED;
+    TrackState = SCOPE_PARKING;
+    trackingTargetValid = false;
+    StartParkStage(PARK_STAGE_RESET, ln_get_julian_from_sys());
+    LOG_INFO("Parking, resetting axes");
     return true;
 }
 
@@ -625,6 +1534,8 @@ bool BenroPolaris::Park() {
  ***************************************************************************************/
 bool BenroPolaris::UnPark() {
     LOG_INFO("UnPark");
+    parkStage = PARK_STAGE_NONE;
+    SetParked(false);
     return true;
 }
 
@@ -632,7 +1543,16 @@ bool BenroPolaris::UnPark() {
  ** Client is asking us to set current park
  ***************************************************************************************/
 bool BenroPolaris::SetCurrentPark() {
-    LOG_INFO("SetCurrentPark");
+    INDI::IHorizontalCoordinates altAz { 0, 0 };
+    if (!GetPredictedPose(ln_get_julian_from_sys(), altAz)) {
+        LOG_ERROR("No position received from the mount yet, cannot set park position");
+        return false;
+    }
+
+    LOGF_INFO("SetCurrentPark: Az %f Alt %f", altAz.azimuth, altAz.altitude);
+    SetAxis1Park(altAz.azimuth);
+    SetAxis2Park(altAz.altitude);
+    SaveParkState();
     return true;
 }
 
@@ -641,9 +1561,377 @@ bool BenroPolaris::SetCurrentPark() {
  ***************************************************************************************/
 bool BenroPolaris::SetDefaultPark() {
     LOG_INFO("SetDefaultPark");
+    SetAxis1Park(GetAxis1ParkDefault());
+    SetAxis2Park(GetAxis2ParkDefault());
+    SaveParkState();
     return true;
 }
 
+/**************************************************************************************
+ ** Enter a park stage, completion is detected once the axes stopped moving
+ ***************************************************************************************/
+void BenroPolaris::StartParkStage(ParkStage stage, double jd) {
+    parkStage = stage;
+    parkStageStart = jd;
+    parkLastSample = 0;
+    parkSettledSince = 0;
+    parkMotionSeen = false;
+}
+
+/**************************************************************************************
+ ** Remember when the axes last moved while parking, and since when samples show them still
+ ***************************************************************************************/
+void BenroPolaris::TrackParkMotion(const INDI::IHorizontalCoordinates &altAz, double jd) {
+    if (parkStage == PARK_STAGE_NONE) {
+        parkLastPose = altAz;
+        return;
+    }
+
+    if ((jd - parkLastSample) * SECONDS_PER_DAY > PARK_MAX_SAMPLE_GAP) {
+        parkSettledSince = jd;
+    }
+    parkLastSample = jd;
+
+    if (std::abs(std::remainder(altAz.azimuth - parkLastPose.azimuth, 360.)) > PARK_SETTLED_MOTION ||
+        std::abs(altAz.altitude - parkLastPose.altitude) > PARK_SETTLED_MOTION) {
+        parkLastPose = altAz;
+        parkSettledSince = jd;
+        parkMotionSeen = true;
+    }
+}
+
+/**************************************************************************************
+ ** Advance the park stages once the axes settled
+ ***************************************************************************************/
+void BenroPolaris::UpdateParkState(double jd) {
+    if (parkStage == PARK_STAGE_NONE) {
+        return;
+    }
+
+    if ((jd - parkStageStart) * SECONDS_PER_DAY > PARK_TIMEOUT) {
+        LOG_ERROR("Parking timed out, axes did not settle");
+        parkStage = PARK_STAGE_NONE;
+        TrackState = SCOPE_IDLE;
+        ParkSP.setState(IPS_ALERT);
+        ParkSP.apply();
+        return;
+    }
+
+    // settled only on fresh samples covering the whole window, after the axes actually moved
+    if (!parkMotionSeen && (jd - parkStageStart) * SECONDS_PER_DAY < PARK_MIN_STAGE_TIME) {
+        return;
+    }
+    if (parkSettledSince == 0 || (jd - parkLastSample) * SECONDS_PER_DAY > PARK_MAX_SAMPLE_GAP ||
+        (jd - parkSettledSince) * SECONDS_PER_DAY < PARK_SETTLE_TIME) {
+        return;
+    }
+
+    if (parkStage == PARK_STAGE_RESET) {
+        // the settled pose is the head's home, keep an uncustomized park position on it
+        const bool customPark = HasCustomPark();
+        SetAxis1ParkDefault(parkLastPose.azimuth);
+        SetAxis2ParkDefault(parkLastPose.altitude);
+        if (!customPark) {
+            SetAxis1Park(parkLastPose.azimuth);
+            SetAxis2Park(parkLastPose.altitude);
+        }
+        SaveParkState();
+        if (customPark) {
+            LOGF_INFO("Axes reset, moving to park position Az %f Alt %f", GetAxis1Park(), GetAxis2Park());
+            INDI::IHorizontalCoordinates parkPosition { 0, 0 };
+            parkPosition.azimuth = GetAxis1Park();
+            parkPosition.altitude = GetAxis2Park();
+            SendGoto(parkPosition, false);
+            StartParkStage(PARK_STAGE_MOVE, jd);
+            return;
+        }
+    }
+
+    LOG_INFO("Mount parked, axes settled");
+    parkStage = PARK_STAGE_NONE;
+    SetParked(true);
+}
+
+/**************************************************************************************
+ ** Whether the park position was moved away from the head's home
+ ***************************************************************************************/
+bool BenroPolaris::HasCustomPark() {
+    return std::abs(std::remainder(GetAxis1Park() - GetAxis1ParkDefault(), 360.)) > PARK_SETTLED_MOTION ||
+           std::abs(GetAxis2Park() - GetAxis2ParkDefault()) > PARK_SETTLED_MOTION;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Pose Estimation
+/////////////////////////////////////////////////////////////////////////////////////
+
+/**************************************************************************************
+ ** Filtered alt/az at any time, extrapolated between 518 samples
+ ***************************************************************************************/
+bool BenroPolaris::GetPredictedPose(double jd, INDI::IHorizontalCoordinates &altAz) const {
+    return poseFilter.Predict(jd, altAz.azimuth, altAz.altitude);
+}
+
+/**************************************************************************************
+ ** Filtered RA/Dec at any time, extrapolated between 518 samples
+ ***************************************************************************************/
+bool BenroPolaris::GetPredictedEquatorial(double jd, INDI::IEquatorialCoordinates &eq) const {
+    INDI::IHorizontalCoordinates altAz { 0, 0 };
+    if (!GetPredictedPose(jd, altAz)) {
+        return false;
+    }
+
+    INDI::IGeographicCoordinates location = m_Location;
+    INDI::HorizontalToEquatorial(&altAz, &location, jd, &eq);
+    return true;
+}
+
+/**************************************************************************************
+ ** Publish a pose once it moved noticeably
+ ***************************************************************************************/
+void BenroPolaris::PublishPose(const INDI::IHorizontalCoordinates &altAz, double jd) {
+    if (std::abs(AltAzNP[ALT].getValue() - altAz.altitude) <= 0.001 &&
+        std::abs(AltAzNP[AZM].getValue() - altAz.azimuth) <= 0.001) {
+        return;
+    }
+
+    INDI::IHorizontalCoordinates AltAz = altAz;
+    INDI::IEquatorialCoordinates Eq { 0, 0 };
+    INDI::HorizontalToEquatorial(&AltAz, &m_Location, jd, &Eq);
+
+    AltAzNP[AZM].setValue(AltAz.azimuth);
+    AltAzNP[ALT].setValue(AltAz.altitude);
+    AltAzNP.apply();
+
+    NewRaDec(Eq.rightascension, Eq.declination);
+}
+
+/**************************************************************************************
+ ** Publish estimated rates and the filter's confidence
+ ***************************************************************************************/
+void BenroPolaris::UpdatePoseStats() {
+    PoseNP[POSE_AZ_RATE].setValue(poseFilter.GetAzRate() * 3600.);
+    PoseNP[POSE_ALT_RATE].setValue(poseFilter.GetAltRate() * 3600.);
+    PoseNP[POSE_SIGMA].setValue(poseFilter.GetPositionSigma() * 3600.);
+    PoseNP[POSE_REJECTED].setValue(poseFilter.GetRejectedCount());
+    PoseNP.setState(poseFilter.IsInitialized() ? IPS_OK : IPS_IDLE);
+    PoseNP.apply();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Field Rotation
+/////////////////////////////////////////////////////////////////////////////////////
+
+/**************************************************************************************
+ ** Parallactic angle and its rate at the pose, and the longest exposure whose
+ ** rotation at the field edge stays within the smear budget
+ ***************************************************************************************/
+void BenroPolaris::UpdateFieldRotation(const INDI::IHorizontalCoordinates &altAz) {
+    const double latitude = m_Location.latitude * M_PI / 180.;
+    const double azimuth = altAz.azimuth * M_PI / 180.; // from north through east
+    const double altitude = altAz.altitude * M_PI / 180.;
+
+    // q = atan2(-sin A cos phi, sin phi cos h - cos phi sin h cos A), dq/dt = -w cos phi cos A / cos h
+    const double angle = std::atan2(-std::sin(azimuth) * std::cos(latitude),
+                                    std::sin(latitude) * std::cos(altitude) - std::cos(latitude) * std::sin(altitude) * std::cos(azimuth));
+    const double cosAltitude = std::max(std::cos(altitude), ROTATION_MIN_COS_ALT);
+    const double rate = -SIDEREAL_RATE * std::cos(latitude) * std::cos(azimuth) / cosAltitude; // rad/s
+
+    // an arc of r * dq at the field edge
+    const double edgeRate = std::abs(rate) * RotationSettingsNP[ROTATION_FIELD_RADIUS].getValue() * 60.; // arcsec/s
+    const double budget = RotationSettingsNP[ROTATION_BUDGET].getValue();
+    const double maxExposure = edgeRate > budget / ROTATION_EXPOSURE_CAP ? budget / edgeRate : ROTATION_EXPOSURE_CAP;
+
+    RotationNP[ROTATION_ANGLE].setValue(angle * 180. / M_PI);
+    RotationNP[ROTATION_RATE].setValue(rate * 180. / M_PI * 60.);
+    RotationNP[ROTATION_MAX_EXPOSURE].setValue(maxExposure);
+    RotationNP.setState(IPS_OK);
+    RotationNP.apply();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Tracking
+/////////////////////////////////////////////////////////////////////////////////////
+
+/**************************************************************************************
+ ** Follow the given coordinates from now on, the mount is assumed to be pointing there
+ ***************************************************************************************/
+void BenroPolaris::LockTrackingTarget(const INDI::IEquatorialCoordinates &eq, double jd) {
+    // residuals against the old target don't continue the recording
+    if (PecControlSP[PEC_RECORD].getState() == ISS_ON && pec.GetSampleCount() > 0) {
+        LOGF_INFO("Tracking target changed, PEC recording restarted after %d samples", static_cast<int>(pec.GetSampleCount()));
+        pec.Restart();
+    }
+    trackingTarget = eq;
+    trackingTargetValid = true;
+    trackingTargetUpdated = jd;
+    trackingDriftRA = 0;
+    trackingDriftDE = 0;
+}
+
+/**************************************************************************************
+ ** Refresh the cached differential rates of the selected track mode
+ ***************************************************************************************/
+void BenroPolaris::UpdateTrackRates(double jd) {
+    const int mode = TrackModeSP.findOnSwitchIndex();
+    if (mode == trackRatesMode && (jd - trackRatesUpdated) * SECONDS_PER_DAY < TRACK_RATE_REFRESH) {
+        return;
+    }
+    trackRatesMode = mode;
+    trackRatesUpdated = jd;
+
+    ln_equ_posn from { 0, 0 }, to { 0, 0 };
+    switch (mode) {
+        case TRACK_SOLAR:
+        case TRACK_LUNAR:
+            GetTopocentricPosition(mode, jd, from);
+            GetTopocentricPosition(mode, jd + TRACK_RATE_BASELINE / SECONDS_PER_DAY, to);
+            break;
+        case TRACK_CUSTOM:
+            // TrackRateNP is the mount's rate in arcsec/s, the target moves by what it lacks to sidereal
+            trackRateRA = (TRACKRATE_SIDEREAL - TrackRateNP[AXIS_RA].getValue()) / 3600.;
+            trackRateDE = TrackRateNP[AXIS_DE].getValue() / 3600.;
+            LOGF_DEBUG("Track rates RA %f DE %f arcsec/s", trackRateRA * 3600., trackRateDE * 3600.);
+            return;
+        default:
+            trackRateRA = 0;
+            trackRateDE = 0;
+            return;
+    }
+
+    trackRateRA = std::remainder(to.ra - from.ra, 360.) / TRACK_RATE_BASELINE;
+    trackRateDE = (to.dec - from.dec) / TRACK_RATE_BASELINE;
+    LOGF_DEBUG("Track rates RA %f DE %f arcsec/s", trackRateRA * 3600., trackRateDE * 3600.);
+}
+
+/**************************************************************************************
+ ** Position of the Sun or Moon seen from the site, the Moon's parallax changes its
+ ** rate by up to 0.2 arcsec/s as the Earth turns
+ ***************************************************************************************/
+void BenroPolaris::GetTopocentricPosition(int mode, double jd, ln_equ_posn &position) const {
+    double distance = 0; // AU
+    if (mode == TRACK_LUNAR) {
+        ln_get_lunar_equ_coords(jd, &position);
+        distance = ln_get_lunar_earth_dist(jd) / KM_PER_AU;
+    } else {
+        ln_get_solar_equ_coords(jd, &position);
+        distance = ln_get_earth_solar_dist(jd);
+    }
+
+    ln_lnlat_posn observer { m_Location.longitude, m_Location.latitude };
+    ln_equ_posn parallax { 0, 0 };
+    ln_get_parallax_jd(&position, distance, &observer, m_Location.elevation, jd, &parallax);
+    position.ra += parallax.ra;
+    position.dec += parallax.dec;
+}
+
+/**************************************************************************************
+ ** Move the target at the cached rates and re-point the tracking mount when the target
+ ** or the predicted periodic error moved by more than a correction step
+ ***************************************************************************************/
+void BenroPolaris::ApplyTrackingCorrections(double jd) {
+    if (TrackState != SCOPE_TRACKING || !trackingTargetValid || parkStage != PARK_STAGE_NONE) {
+        return;
+    }
+
+    UpdateTrackRates(jd);
+    const double dt = (jd - trackingTargetUpdated) * SECONDS_PER_DAY;
+    trackingTargetUpdated = jd;
+    trackingTarget.rightascension = range24(trackingTarget.rightascension + trackRateRA * dt / 15.);
+    trackingTarget.declination = rangeDec(trackingTarget.declination + trackRateDE * dt);
+    trackingDriftRA += trackRateRA * dt / 15.;
+    trackingDriftDE += trackRateDE * dt;
+
+    const double drift = std::hypot(trackingDriftRA * 15. * std::cos(trackingTarget.declination * M_PI / 180.),
+                                    trackingDriftDE) * 3600.;
+    const bool pecActive = PECStateSP[PEC_ON].getState() == ISS_ON;
+    double azError = 0, altError = 0;
+    if (pecActive) {
+        pec.Predict(jd, azError, altError);
+    }
+    const double pecStep = std::hypot(-azError - pecAppliedAz, -altError - pecAppliedAlt);
+    if (drift < TRACK_CORRECTION_STEP && (!pecActive || pecStep < PecSettingsNP[PEC_THRESHOLD].getValue())) {
+        return;
+    }
+
+    INDI::IHorizontalCoordinates target { 0, 0 };
+    INDI::EquatorialToHorizontal(&trackingTarget, &m_Location, jd, &target);
+    target.azimuth = range360(target.azimuth - azError / 3600.);
+    target.altitude -= altError / 3600.;
+    SendGoto(target, true);
+
+    trackingDriftRA = 0;
+    trackingDriftDE = 0;
+    pecAppliedAz = -azError;
+    pecAppliedAlt = -altError;
+}
+
+/**************************************************************************************
+ ** Point the mount at alt/az, with track set it keeps tracking (used for corrections)
+ ***************************************************************************************/
+void BenroPolaris::SendGoto(const INDI::IHorizontalCoordinates &altAz, bool track) {
+    WriteRequest(EncodeRequest(CMD_519_GOTO, 3, {
+        {"state", "1"},
+        {"yaw", std::to_string(std::round(altAz.azimuth * 10000) / 10000)},
+        {"pitch", std::to_string(std::round(altAz.altitude * 10000) / 10000)},
+        {"lat", std::to_string(std::round(m_Location.latitude * 10000) / 10000)},
+        {"track", track ? "1" : "0"},
+        {"speed", "0"},
+        {"lng", std::to_string(std::round(m_Location.longitude * 10000) / 10000)},
+    }));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+/// Periodic Error Correction
+/////////////////////////////////////////////////////////////////////////////////////
+
+/**************************************************************************************
+ ** Compare a tracking pose against the locked target and feed the residual to the PEC
+ ***************************************************************************************/
+void BenroPolaris::RecordTrackingResidual(const INDI::IHorizontalCoordinates &altAz, double jd) {
+    if (TrackState != SCOPE_TRACKING || parkStage != PARK_STAGE_NONE) {
+        return;
+    }
+
+    if (!trackingTargetValid) {
+        // lock on the filtered pose, a raw sample would bake its AHRS noise into the target
+        INDI::IHorizontalCoordinates current { 0, 0 };
+        if (!GetPredictedPose(jd, current)) {
+            return;
+        }
+        INDI::IEquatorialCoordinates eq { 0, 0 };
+        INDI::HorizontalToEquatorial(&current, &m_Location, jd, &eq);
+        LockTrackingTarget(eq, jd);
+        return;
+    }
+
+    INDI::IHorizontalCoordinates expected { 0, 0 };
+    INDI::EquatorialToHorizontal(&trackingTarget, &m_Location, jd, &expected);
+    const double azResidual = std::remainder(altAz.azimuth - expected.azimuth, 360.) * 3600.;
+    const double altResidual = (altAz.altitude - expected.altitude) * 3600.;
+    if (std::abs(azResidual) > PEC_MAX_RESIDUAL || std::abs(altResidual) > PEC_MAX_RESIDUAL) {
+        return;
+    }
+
+    if (PECStateSP[PEC_ON].getState() == ISS_ON) {
+        pec.RecordCorrected(azResidual, altResidual);
+    } else if (PecControlSP[PEC_RECORD].getState() == ISS_ON) {
+        pec.Record(jd, azResidual, altResidual);
+    }
+}
+
+/**************************************************************************************
+ ** Publish recorder and model statistics
+ ***************************************************************************************/
+void BenroPolaris::UpdatePECStats() {
+    PecStatsNP[PEC_SAMPLES].setValue(pec.GetSampleCount());
+    PecStatsNP[PEC_PERIOD].setValue(pec.GetDominantPeriod());
+    PecStatsNP[PEC_RMS_BEFORE].setValue(pec.GetRawRMS());
+    PecStatsNP[PEC_RMS_FIT].setValue(pec.GetFitRMS());
+    PecStatsNP[PEC_RMS_AFTER].setValue(pec.GetCorrectedRMS());
+    PecStatsNP.setState(pec.IsAnalyzed() ? IPS_OK : IPS_IDLE);
+    PecStatsNP.apply();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////
 /// Misc.
 /////////////////////////////////////////////////////////////////////////////////////
@@ -656,10 +1944,15 @@ void BenroPolaris::TimerHit() {
         return;
     }
 
+    const double jd = ln_get_julian_from_sys();
+    CheckLinkHealth(jd);
+    if (linkLost) {
+        SetTimer(KEEPALIVE_PERIOD);
+        return;
+    }
+
     const int64_t now = std::chrono::system_clock::now().time_since_epoch().count();
-    const int16_t positionUpdateAge = responses.find(CMD_518_AHRS) != responses.end()
-        ? responses[CMD_518_AHRS].second
-        : POSITION_UPDATE_MAX_AGE;
+    const double positionUpdateAge = lastPoseJd > 0 ? (jd - lastPoseJd) * SECONDS_PER_DAY * 1000. : POSITION_UPDATE_MAX_AGE;
     if (positionUpdateAge >= POSITION_UPDATE_MAX_AGE) {
         LOG_WARN("Last position update more than 5 seconds ago, tracking?");
     }
@@ -674,9 +1967,133 @@ void BenroPolaris::TimerHit() {
         WriteRequest(EncodeRequest(CMD_284_MODE, 2));
     }
 
+    // publish the extrapolated pose between 518 samples
+    INDI::IHorizontalCoordinates estimate { 0, 0 };
+    if ((jd - poseFilter.GetLastUpdate()) * SECONDS_PER_DAY < POSE_MAX_EXTRAPOLATION && GetPredictedPose(jd, estimate)) {
+        PublishPose(estimate, jd);
+    }
+    UpdatePoseStats();
+    UpdateParkState(jd);
+
+    ApplyTrackingCorrections(jd);
+    if (PecControlSP[PEC_RECORD].getState() == ISS_ON || PECStateSP[PEC_ON].getState() == ISS_ON) {
+        UpdatePECStats();
+    }
+
     SetTimer(KEEPALIVE_PERIOD);
 }
 
+/**************************************************************************************
+ ** Map the state file and put the last known state to use right away
+ ***************************************************************************************/
+void BenroPolaris::LoadState() {
+    const char *home = getenv("HOME");
+    const std::string directory = std::string(home != nullptr ? home : ".") + "/.indi";
+    mkdir(directory.c_str(), 0755);
+    const std::string path = directory + "/" + getDeviceName() + "_state.dat";
+    if (!stateFile.Open(path)) {
+        LOGF_WARN("Cannot open state file %s (%s), starting without cached state", path.c_str(), strerror(errno));
+        return;
+    }
+    if (!stateFile.IsLoaded()) {
+        LOGF_INFO("Created state file %s", path.c_str());
+        return;
+    }
+
+    const PolarisState *state = stateFile.Get();
+    DeviceInfoTP[HARDWARE_VERSION].setText(state->hardwareVersion);
+    DeviceInfoTP[SOFTWARE_VERSION].setText(state->softwareVersion);
+    DeviceInfoTP[ASTRO_MODULE_VERSION].setText(state->astroModuleVersion);
+    DeviceInfoTP[SV].setText(state->sv);
+    DeviceInfoTP[OV].setText(state->ov);
+    StorageNP[TOTAL].setValue(state->storageTotal);
+    StorageNP[FREE].setValue(state->storageFree);
+    StorageNP[USED].setValue(state->storageUsed);
+    BatteryNP[CAPACITY].setValue(state->batteryCapacity);
+    const size_t azTerms = std::min<size_t>(state->pecAzTermCount, POLARIS_STATE_MAX_PEC_TERMS);
+    const size_t altTerms = std::min<size_t>(state->pecAltTermCount, POLARIS_STATE_MAX_PEC_TERMS);
+    if (azTerms + altTerms > 0) {
+        pec.SetModel(state->pecEpoch,
+                     std::vector<PolarisPEC::Term>(state->pecAzTerms, state->pecAzTerms + azTerms),
+                     std::vector<PolarisPEC::Term>(state->pecAltTerms, state->pecAltTerms + altTerms));
+    }
+
+    LOGF_INFO("Loaded cached state from %s: firmware %s, last pose Az %f Alt %f, %s PEC model",
+              path.c_str(), state->softwareVersion, state->poseAz, state->poseAlt, pec.IsAnalyzed() ? "with" : "no");
+}
+
+/**************************************************************************************
+ ** Publish the cached pose until 518 samples arrive, if it is recent enough to be trusted
+ ***************************************************************************************/
+void BenroPolaris::RestoreCachedPose(double jd) {
+    const PolarisState *state = stateFile.Get();
+    if (state == nullptr || state->poseJd <= 0) {
+        return;
+    }
+
+    const double age = (jd - state->poseJd) * SECONDS_PER_DAY;
+    if (age < 0 || age > STATE_POSE_MAX_AGE) {
+        LOGF_DEBUG("Cached pose is %.0f s old, waiting for the mount", age);
+        return;
+    }
+
+    // the sky position holds while tracking, so report the RA/Dec the pose had when cached
+    INDI::IHorizontalCoordinates altAz { 0, 0 };
+    altAz.azimuth = state->poseAz;
+    altAz.altitude = state->poseAlt;
+    INDI::IEquatorialCoordinates eq { 0, 0 };
+    INDI::HorizontalToEquatorial(&altAz, &m_Location, state->poseJd, &eq);
+
+    AltAzNP[AZM].setValue(altAz.azimuth);
+    AltAzNP[ALT].setValue(altAz.altitude);
+    AltAzNP.apply();
+    NewRaDec(eq.rightascension, eq.declination);
+    LOGF_INFO("Using cached pose from %.1f s ago until the mount reports", age);
+}
+
+/**************************************************************************************
+ ** Keep the park position in the state file
+ ***************************************************************************************/
+void BenroPolaris::SaveParkState() {
+    if (PolarisState *state = stateFile.Get()) {
+        state->parkAz = GetAxis1Park();
+        state->parkAlt = GetAxis2Park();
+        state->parkDefaultAz = GetAxis1ParkDefault();
+        state->parkDefaultAlt = GetAxis2ParkDefault();
+        state->parkValid = 1;
+    }
+}
+
+/**************************************************************************************
+ ** Keep the PEC model in the state file
+ ***************************************************************************************/
+void BenroPolaris::SavePECState() {
+    PolarisState *state = stateFile.Get();
+    if (state == nullptr) {
+        return;
+    }
+
+    const auto &azTerms = pec.GetAzTerms();
+    const auto &altTerms = pec.GetAltTerms();
+    state->pecEpoch = pec.GetModelEpoch();
+    state->pecAzTermCount = std::min(azTerms.size(), POLARIS_STATE_MAX_PEC_TERMS);
+    state->pecAltTermCount = std::min(altTerms.size(), POLARIS_STATE_MAX_PEC_TERMS);
+    std::copy(azTerms.begin(), azTerms.begin() + state->pecAzTermCount, state->pecAzTerms);
+    std::copy(altTerms.begin(), altTerms.begin() + state->pecAltTermCount, state->pecAltTerms);
+    stateFile.Flush();
+}
+
+/**************************************************************************************
+ ** Save driver settings
+ ***************************************************************************************/
+bool BenroPolaris::saveConfigItems(FILE *fp) {
+    INDI::Telescope::saveConfigItems(fp);
+    PecSettingsNP.save(fp);
+    RotationSettingsNP.save(fp);
+    CommandBatchNP.save(fp);
+    return true;
+}
+
 /**************************************************************************************
  ** Client is giving a new location
  ***************************************************************************************/
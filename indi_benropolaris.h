@@ -1,9 +1,15 @@
 #pragma once
 
+#include "atomic"
+#include "deque"
+#include "thread"
 #include "inditelescope.h"
 #include "indiguiderinterface.h"
 #include "indipropertyswitch.h"
 #include "alignment/AlignmentSubsystemForDrivers.h"
+#include "polaris_kalman.h"
+#include "polaris_pec.h"
+#include "polaris_state.h"
 
 // typedef enum { PARK_COUNTERCLOCKWISE = 0, PARK_CLOCKWISE } ParkDirection_t;
 // typedef enum { PARK_NORTH = 0, PARK_EAST, PARK_SOUTH, PARK_WEST } ParkPosition_t;
@@ -11,6 +17,7 @@
 class BenroPolaris : public INDI::Telescope, public INDI::AlignmentSubsystem::AlignmentSubsystemForDrivers {
     public:
         BenroPolaris();
+        virtual ~BenroPolaris();
 
         virtual bool initProperties() override;
         virtual void ISGetProperties(const char *dev) override;
@@ -48,7 +55,7 @@ class BenroPolaris : public INDI::Telescope, public INDI::AlignmentSubsystem::Al
         virtual const char *getDefaultName() override;
         virtual void TimerHit() override;
         virtual bool updateLocation(double latitude, double longitude, double elevation) override;
-        // virtual bool saveConfigItems(FILE *fp) override;
+        virtual bool saveConfigItems(FILE *fp) override;
         // double GetSlewRate();
         // double GetParkDeltaAz(ParkDirection_t target_direction, ParkPosition_t target_position);
 
@@ -68,19 +75,153 @@ class BenroPolaris : public INDI::Telescope, public INDI::AlignmentSubsystem::Al
         virtual bool SetCurrentPark() override;
         virtual bool SetDefaultPark() override;
 
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Pose Estimation
+        /////////////////////////////////////////////////////////////////////////////////////
+        bool GetPredictedPose(double jd, INDI::IHorizontalCoordinates &altAz) const;
+        bool GetPredictedEquatorial(double jd, INDI::IEquatorialCoordinates &eq) const;
+
     private:
         /////////////////////////////////////////////////////////////////////////////////////
         /// Comunication
         /////////////////////////////////////////////////////////////////////////////////////
-        void WriteRequest(std::string request, bool readResponse = true, int retries = 3);
+        bool WriteRequest(std::string request, bool readResponse = true, int retries = 3, bool timed = true);
         void ReadResponses(int portRef);
-        int readResponseCallback;
+        int readResponseCallback { -1 };
+        std::string receiveBuffer;
+
+        // send times of timed requests waiting for their response, oldest first per command,
+        // and the resulting transport delay
+        std::map<int, std::deque<double>> pendingRequests;
+        double smoothedRoundTrip { 0 };
+        double minRoundTrip { 0 };
+        void UpdateRoundTrip(int command, double receivedJd);
+        double GetSampleTime(double receivedJd) const;
+
+        // liveness of the link, the 518 stream and 284 polls are the heartbeat
+        double lastFrameJd { 0 };
+        double lastPoseJd { 0 };
+        bool linkLost { false };
+        bool linkResuming { false };
+        double linkLostJd { 0 };
+        double linkLastFrameJd { 0 }; // newest frame before the link was declared dead
+        double linkRetryJd { 0 };
+        int linkAttempts { 0 };
+        int linkDropouts { 0 };
+        bool linkPendingAbort { false };    // stops refused while the link was down, sent first on reconnect
+        bool linkPendingTrackOff { false };
+        std::thread reconnectThread;
+        std::atomic<int> reconnectFd { -1 };
+        std::atomic<bool> reconnectDone { false };
+        double GetLinkTimeout() const;
+        void CheckLinkHealth(double jd);
+        void LinkLost(const char *reason, double jd);
+        void StartReconnect();
+        void FinishReconnect(double jd);
+        void ResumeSession(double jd);
+        static int OpenSocket(const std::string &host, uint32_t port);
 
         // void Keepalive();
         // int keepaliveTimer;
         
+        // the handshake may run on the mode cached from the last run, until 284 confirms it
+        bool modeFromCache { false };
+        bool astroMode { true };
+        bool ValidateMode(const std::string &mode, const std::string &track, bool report);
+
         std::map<int, std::pair<std::map<std::string, std::string>, int64_t>> responses;
-        void StoreResponseAndUpdateState(std::pair<int, std::map<std::string, std::string>> decodedResponse);
+        void StoreResponseAndUpdateState(std::pair<int, std::map<std::string, std::string>> decodedResponse, double receivedJd);
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Tracking
+        /////////////////////////////////////////////////////////////////////////////////////
+        INDI::IEquatorialCoordinates trackingTarget { 0, 0 };
+        bool trackingTargetValid { false };
+        double trackingTargetUpdated { 0 };
+        double trackingDriftRA { 0 }; // hours, target motion not yet sent to the mount
+        double trackingDriftDE { 0 }; // degrees
+        void LockTrackingTarget(const INDI::IEquatorialCoordinates &eq, double jd);
+        void ApplyTrackingCorrections(double jd);
+        void SendGoto(const INDI::IHorizontalCoordinates &altAz, bool track);
+        bool SendStop();
+
+        // differential rates of the tracked body against sidereal, refreshed on a slow schedule
+        double trackRateRA { 0 }; // deg/s
+        double trackRateDE { 0 }; // deg/s
+        double trackRatesUpdated { 0 };
+        int trackRatesMode { -1 };
+        void UpdateTrackRates(double jd);
+        void GetTopocentricPosition(int mode, double jd, struct ln_equ_posn &position) const;
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Pose Estimation
+        /////////////////////////////////////////////////////////////////////////////////////
+        PolarisKalman poseFilter;
+        void PublishPose(const INDI::IHorizontalCoordinates &altAz, double jd);
+        void UpdatePoseStats();
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Parking
+        /////////////////////////////////////////////////////////////////////////////////////
+        enum ParkStage
+        {
+            PARK_STAGE_NONE,
+            PARK_STAGE_RESET, // axes return to the head's home
+            PARK_STAGE_MOVE,  // slew from home to a custom park position
+        };
+        ParkStage parkStage { PARK_STAGE_NONE };
+        double parkStageStart { 0 };
+        double parkLastSample { 0 };
+        double parkSettledSince { 0 }; // start of the current run of fresh, motionless samples
+        bool parkMotionSeen { false };
+        INDI::IHorizontalCoordinates parkLastPose { 0, 0 };
+        void StartParkStage(ParkStage stage, double jd);
+        void TrackParkMotion(const INDI::IHorizontalCoordinates &altAz, double jd);
+        void UpdateParkState(double jd);
+        bool HasCustomPark();
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Periodic Error Correction
+        /////////////////////////////////////////////////////////////////////////////////////
+        PolarisPEC pec;
+        double pecAppliedAz { 0 };
+        double pecAppliedAlt { 0 };
+        void RecordTrackingResidual(const INDI::IHorizontalCoordinates &altAz, double jd);
+        void UpdatePECStats();
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Field Rotation
+        /////////////////////////////////////////////////////////////////////////////////////
+        void UpdateFieldRotation(const INDI::IHorizontalCoordinates &altAz);
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Command Batches
+        /////////////////////////////////////////////////////////////////////////////////////
+        struct BatchCommand {
+            std::string request;
+            int command;
+            double sentJd;
+            double receivedJd;
+            std::string response;
+        };
+        std::vector<BatchCommand> batchCommands;
+        size_t batchNext { 0 };
+        int batchTimer { -1 };
+        std::string batchOutput;
+        std::vector<std::string> ParseCommandFrames(const std::string &text);
+        void StartCommandBatch(const std::vector<std::string> &frames, const std::string &output);
+        void RunCommandBatch();
+        bool MatchBatchResponse(const std::string &response, double receivedJd);
+        void FinishCommandBatch();
+
+        /////////////////////////////////////////////////////////////////////////////////////
+        /// Persistent State
+        /////////////////////////////////////////////////////////////////////////////////////
+        PolarisStateFile stateFile;
+        void LoadState();
+        void RestoreCachedPose(double jd);
+        void SaveParkState();
+        void SavePECState();
 
         /////////////////////////////////////////////////////////////////////////////////////
         /// Message Encoding/Decoding
@@ -89,6 +230,7 @@ class BenroPolaris : public INDI::Telescope, public INDI::AlignmentSubsystem::Al
         std::string EncodeRequest(int command, int type, std::map<std::string, std::string> data);
         std::string EncodeRequest(int command, int type, std::string data);
         std::string EncodeRequest(int command, int type);
+        int DecodeRequestCommand(const std::string &request);
 
         /////////////////////////////////////////////////////////////////////////////////////
         /// Properties
@@ -100,6 +242,15 @@ class BenroPolaris : public INDI::Telescope, public INDI::AlignmentSubsystem::Al
             AZM,
         };
 
+        INDI::PropertyNumber PoseNP {4};
+        enum
+        {
+            POSE_AZ_RATE,
+            POSE_ALT_RATE,
+            POSE_SIGMA,
+            POSE_REJECTED,
+        };
+
         INDI::PropertyText DeviceInfoTP {5};
         enum
         {
@@ -124,10 +275,83 @@ class BenroPolaris : public INDI::Telescope, public INDI::AlignmentSubsystem::Al
             CAPACITY,
         };
 
+        INDI::PropertyNumber LatencyNP {3};
+        enum
+        {
+            LATENCY_RTT,
+            LATENCY_RTT_MIN,
+            LATENCY_DELAY,
+        };
+
+        INDI::PropertyNumber LinkNP {5};
+        enum
+        {
+            LINK_AGE,
+            LINK_TIMEOUT,
+            LINK_DROPOUTS,
+            LINK_OUTAGE,
+            LINK_RECOVERY,
+        };
+
         INDI::PropertyText CommandTP {2};
         enum
         {   
             REQUEST,
             RESPONSE,
         };
+
+        INDI::PropertyNumber RotationNP {3};
+        enum
+        {
+            ROTATION_ANGLE,
+            ROTATION_RATE,
+            ROTATION_MAX_EXPOSURE,
+        };
+
+        INDI::PropertyNumber RotationSettingsNP {2};
+        enum
+        {
+            ROTATION_BUDGET,
+            ROTATION_FIELD_RADIUS,
+        };
+
+        INDI::PropertyText CommandBatchTP {3};
+        enum
+        {
+            BATCH_FRAMES,
+            BATCH_SCRIPT,
+            BATCH_OUTPUT,
+        };
+
+        INDI::PropertyNumber CommandBatchNP {2};
+        enum
+        {
+            BATCH_SPACING,
+            BATCH_TIMEOUT,
+        };
+
+        INDI::PropertySwitch PecControlSP {3};
+        enum
+        {
+            PEC_RECORD,
+            PEC_ANALYZE,
+            PEC_CLEAR,
+        };
+
+        INDI::PropertyNumber PecSettingsNP {2};
+        enum
+        {
+            PEC_TERMS,
+            PEC_THRESHOLD,
+        };
+
+        INDI::PropertyNumber PecStatsNP {5};
+        enum
+        {
+            PEC_SAMPLES,
+            PEC_PERIOD,
+            PEC_RMS_BEFORE,
+            PEC_RMS_FIT,
+            PEC_RMS_AFTER,
+        };
 };
\ No newline at end of file
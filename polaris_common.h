@@ -0,0 +1,3 @@
+#pragma once
+
+const double SECONDS_PER_DAY = 86400.;
@@ -0,0 +1,176 @@
+#include "polaris_kalman.h"
+
+#include "algorithm"
+#include "cmath"
+#include "gsl/gsl_blas.h"
+#include "gsl/gsl_linalg.h"
+#include "polaris_common.h"
+
+const double KALMAN_GATE = 13.8;               // chi-square, 2 degrees of freedom, 99.9%
+const int KALMAN_MAX_CONSECUTIVE_REJECTED = 3; // the mount really moved, start over
+const double KALMAN_INITIAL_RATE_SIGMA = 1.;   // deg/s
+
+PolarisKalman::PolarisKalman(double measurementSigma, double accelerationSigma)
+    : measurementVariance(measurementSigma * measurementSigma),
+      accelerationVariance(accelerationSigma * accelerationSigma) {
+    x = gsl_vector_calloc(4);
+    P = gsl_matrix_calloc(4, 4);
+    F = gsl_matrix_calloc(4, 4);
+    Q = gsl_matrix_calloc(4, 4);
+    H = gsl_matrix_calloc(2, 4);
+    R = gsl_matrix_calloc(2, 2);
+    FP = gsl_matrix_calloc(4, 4);
+    PHt = gsl_matrix_calloc(4, 2);
+    S = gsl_matrix_calloc(2, 2);
+    K = gsl_matrix_calloc(4, 2);
+    y = gsl_vector_calloc(2);
+    Sy = gsl_vector_calloc(2);
+    xPredicted = gsl_vector_calloc(4);
+
+    // we measure the two positions, not the rates
+    gsl_matrix_set(H, 0, 0, 1);
+    gsl_matrix_set(H, 1, 2, 1);
+    gsl_matrix_set(R, 0, 0, measurementVariance);
+    gsl_matrix_set(R, 1, 1, measurementVariance);
+}
+
+PolarisKalman::~PolarisKalman() {
+    gsl_vector_free(xPredicted);
+    gsl_vector_free(Sy);
+    gsl_vector_free(y);
+    gsl_matrix_free(K);
+    gsl_matrix_free(S);
+    gsl_matrix_free(PHt);
+    gsl_matrix_free(FP);
+    gsl_matrix_free(R);
+    gsl_matrix_free(H);
+    gsl_matrix_free(Q);
+    gsl_matrix_free(F);
+    gsl_matrix_free(P);
+    gsl_vector_free(x);
+}
+
+/**************************************************************************************
+ ** Forget the current estimate, the next sample initializes the filter again
+ ***************************************************************************************/
+void PolarisKalman::Reset() {
+    initialized = false;
+    lastInnovation = 0;
+    rejected = 0;
+    consecutiveRejected = 0;
+}
+
+/**************************************************************************************
+ ** Fold in a new sample, returns false if it was rejected as an outlier
+ ***************************************************************************************/
+bool PolarisKalman::Update(double jd, double az, double alt) {
+    if (!initialized) {
+        Initialize(jd, az, alt);
+        return true;
+    }
+
+    const double dt = std::max(0., (jd - lastJd) * SECONDS_PER_DAY);
+    lastJd = jd;
+
+    // constant velocity model driven by white noise acceleration
+    gsl_matrix_set_identity(F);
+    gsl_matrix_set_zero(Q);
+    for (size_t axis : { 0, 2 }) {
+        gsl_matrix_set(F, axis, axis + 1, dt);
+        gsl_matrix_set(Q, axis, axis, accelerationVariance * dt * dt * dt / 3);
+        gsl_matrix_set(Q, axis, axis + 1, accelerationVariance * dt * dt / 2);
+        gsl_matrix_set(Q, axis + 1, axis, accelerationVariance * dt * dt / 2);
+        gsl_matrix_set(Q, axis + 1, axis + 1, accelerationVariance * dt);
+    }
+
+    // x = F x, P = F P F' + Q
+    gsl_blas_dgemv(CblasNoTrans, 1., F, x, 0., xPredicted);
+    gsl_vector_memcpy(x, xPredicted);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1., F, P, 0., FP);
+    gsl_matrix_memcpy(P, Q);
+    gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1., FP, F, 1., P);
+
+    // innovation and its covariance S = H P H' + R
+    gsl_vector_set(y, 0, std::remainder(az - gsl_vector_get(x, 0), 360.));
+    gsl_vector_set(y, 1, alt - gsl_vector_get(x, 2));
+    gsl_blas_dgemm(CblasNoTrans, CblasTrans, 1., P, H, 0., PHt);
+    gsl_matrix_memcpy(S, R);
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1., H, PHt, 1., S);
+    if (gsl_linalg_cholesky_decomp1(S) != GSL_SUCCESS || gsl_linalg_cholesky_invert(S) != GSL_SUCCESS) {
+        Initialize(jd, az, alt);
+        return true;
+    }
+
+    // normalized innovation squared y' S^-1 y, gates out bad samples
+    gsl_blas_dgemv(CblasNoTrans, 1., S, y, 0., Sy);
+    gsl_blas_ddot(y, Sy, &lastInnovation);
+    if (lastInnovation > KALMAN_GATE) {
+        rejected++;
+        if (++consecutiveRejected >= KALMAN_MAX_CONSECUTIVE_REJECTED) {
+            Initialize(jd, az, alt);
+            return true;
+        }
+        return false;
+    }
+    consecutiveRejected = 0;
+
+    // K = P H' S^-1, x = x + K y, P = P - K H P
+    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1., PHt, S, 0., K);
+    gsl_blas_dgemv(CblasNoTrans, 1., K, y, 1., x);
+    gsl_blas_dgemm(CblasNoTrans, CblasTrans, -1., K, PHt, 1., P);
+
+    gsl_vector_set(x, 0, std::fmod(gsl_vector_get(x, 0) + 360., 360.));
+    return true;
+}
+
+/**************************************************************************************
+ ** Estimated position at any time, extrapolated with the estimated rates
+ ***************************************************************************************/
+bool PolarisKalman::Predict(double jd, double &az, double &alt) const {
+    if (!initialized) {
+        return false;
+    }
+
+    const double dt = (jd - lastJd) * SECONDS_PER_DAY;
+    az = std::fmod(gsl_vector_get(x, 0) + gsl_vector_get(x, 1) * dt + 360., 360.);
+    alt = gsl_vector_get(x, 2) + gsl_vector_get(x, 3) * dt;
+    return true;
+}
+
+/**************************************************************************************
+ ** Estimated rates, in degrees per second
+ ***************************************************************************************/
+double PolarisKalman::GetAzRate() const {
+    return initialized ? gsl_vector_get(x, 1) : 0;
+}
+
+double PolarisKalman::GetAltRate() const {
+    return initialized ? gsl_vector_get(x, 3) : 0;
+}
+
+/**************************************************************************************
+ ** Combined one sigma position uncertainty of both axes, in degrees
+ ***************************************************************************************/
+double PolarisKalman::GetPositionSigma() const {
+    return initialized ? std::sqrt(gsl_matrix_get(P, 0, 0) + gsl_matrix_get(P, 2, 2)) : 0;
+}
+
+/**************************************************************************************
+ ** Start from a single sample with unknown rates
+ ***************************************************************************************/
+void PolarisKalman::Initialize(double jd, double az, double alt) {
+    gsl_vector_set(x, 0, az);
+    gsl_vector_set(x, 1, 0);
+    gsl_vector_set(x, 2, alt);
+    gsl_vector_set(x, 3, 0);
+
+    gsl_matrix_set_zero(P);
+    gsl_matrix_set(P, 0, 0, measurementVariance);
+    gsl_matrix_set(P, 1, 1, KALMAN_INITIAL_RATE_SIGMA * KALMAN_INITIAL_RATE_SIGMA);
+    gsl_matrix_set(P, 2, 2, measurementVariance);
+    gsl_matrix_set(P, 3, 3, KALMAN_INITIAL_RATE_SIGMA * KALMAN_INITIAL_RATE_SIGMA);
+
+    lastJd = jd;
+    consecutiveRejected = 0;
+    initialized = true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "gsl/gsl_matrix.h"
+#include "gsl/gsl_vector.h"
+
+/**
+ * Position/velocity Kalman filter for both mount axes.
+ *
+ * The state is [az, az rate, alt, alt rate] in degrees and degrees per second, measured by
+ * the 518 AHRS samples. Samples whose innovation falls outside the gate are rejected, and
+ * the filter restarts from the measurement when several are rejected in a row (slews).
+ * Predict() extrapolates the estimate to any time without touching the filter state.
+ * GSL failures are reported through return codes, the driver turns the abort handler off.
+ */
+class PolarisKalman {
+    public:
+        PolarisKalman(double measurementSigma, double accelerationSigma);
+        ~PolarisKalman();
+        PolarisKalman(const PolarisKalman &) = delete;
+        PolarisKalman &operator=(const PolarisKalman &) = delete;
+
+        void Reset();
+        bool Update(double jd, double az, double alt);
+        bool Predict(double jd, double &az, double &alt) const;
+
+        bool IsInitialized() const { return initialized; }
+        double GetLastUpdate() const { return lastJd; }
+        double GetAzRate() const;
+        double GetAltRate() const;
+        double GetPositionSigma() const;
+        double GetLastInnovation() const { return lastInnovation; }
+        int GetRejectedCount() const { return rejected; }
+
+    private:
+        void Initialize(double jd, double az, double alt);
+
+        double measurementVariance;
+        double accelerationVariance;
+
+        bool initialized { false };
+        double lastJd { 0 };
+        double lastInnovation { 0 };
+        int rejected { 0 };
+        int consecutiveRejected { 0 };
+
+        gsl_vector *x;
+        gsl_matrix *P;
+
+        // scratch, allocated once
+        gsl_matrix *F;
+        gsl_matrix *Q;
+        gsl_matrix *H;
+        gsl_matrix *R;
+        gsl_matrix *FP;
+        gsl_matrix *PHt;
+        gsl_matrix *S;
+        gsl_matrix *K;
+        gsl_vector *y;
+        gsl_vector *Sy;
+        gsl_vector *xPredicted;
+};
@@ -0,0 +1,354 @@
+#include "polaris_pec.h"
+
+#include "algorithm"
+#include "cmath"
+#include "gsl/gsl_errno.h"
+#include "gsl/gsl_fft_real.h"
+#include "polaris_common.h"
+
+const size_t PEC_MIN_SAMPLES = 64;
+const size_t PEC_MIN_CYCLES = 2; // a term must repeat at least this often within the recording
+const int PEC_REFINE_ITERATIONS = 40;
+const double PEC_MAX_GAP = 5.; // sample periods, longer gaps start a new segment
+const double PEC_SIGNIFICANCE = 5.; // a term's spectral amplitude over the median bin, noise peaks stay near 3
+
+PolarisPEC::PolarisPEC(size_t capacity)
+    : times(capacity), azResiduals(capacity), altResiduals(capacity),
+      orderedTimes(capacity), orderedValues(capacity), azGrid(capacity), altGrid(capacity), spectrum(capacity),
+      amplitudes(capacity / 2 + 1) {
+}
+
+/**************************************************************************************
+ ** Drop recorded samples and the current model
+ ***************************************************************************************/
+void PolarisPEC::Clear() {
+    head = 0;
+    count = 0;
+    epoch = 0;
+    segmentCount = 0;
+    azTerms.clear();
+    altTerms.clear();
+    modelEpoch = 0;
+    rawRMS = 0;
+    modelRMS = 0;
+    correctedSumSquares = 0;
+    correctedSamples = 0;
+}
+
+/**************************************************************************************
+ ** Store a tracking residual, overwriting the oldest sample once the buffer is full
+ ***************************************************************************************/
+void PolarisPEC::Record(double jd, double azResidual, double altResidual) {
+    if (count == 0) {
+        epoch = jd;
+    }
+
+    const double t = (jd - epoch) * SECONDS_PER_DAY;
+    if (segmentCount >= 2 && t - lastTime > PEC_MAX_GAP * (lastTime - segmentStart) / (segmentCount - 1)) {
+        segmentCount = 0;
+    }
+    if (segmentCount == 0) {
+        segmentStart = t;
+    }
+    lastTime = t;
+    segmentCount = std::min(segmentCount + 1, times.size());
+
+    times[head] = t;
+    azResiduals[head] = azResidual;
+    altResiduals[head] = altResidual;
+
+    head = (head + 1) % times.size();
+    count = std::min(count + 1, times.size());
+}
+
+/**************************************************************************************
+ ** Begin a new segment, residuals recorded so far no longer share the reference
+ ***************************************************************************************/
+void PolarisPEC::Restart() {
+    segmentCount = 0;
+}
+
+/**************************************************************************************
+ ** Accumulate a residual measured while the correction curve is played back
+ ***************************************************************************************/
+void PolarisPEC::RecordCorrected(double azResidual, double altResidual) {
+    correctedSumSquares += azResidual * azResidual + altResidual * altResidual;
+    correctedSamples++;
+}
+
+/**************************************************************************************
+ ** Extract up to maxTerms periodic terms per axis from the recorded residuals
+ ***************************************************************************************/
+bool PolarisPEC::Analyze(size_t maxTerms) {
+    const size_t n = segmentCount;
+    if (n < PEC_MIN_SAMPLES) {
+        return false;
+    }
+
+    const size_t start = (head + times.size() - n) % times.size();
+    for (size_t i = 0; i < n; i++) {
+        orderedTimes[i] = times[(start + i) % times.size()];
+    }
+
+    double dt = 0;
+    for (size_t i = 0; i < n; i++) {
+        orderedValues[i] = azResiduals[(start + i) % times.size()];
+    }
+    if (!Resample(orderedValues, azGrid, n, dt)) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        orderedValues[i] = altResiduals[(start + i) % times.size()];
+    }
+    if (!Resample(orderedValues, altGrid, n, dt)) {
+        return false;
+    }
+
+    std::vector<Term> newAzTerms, newAltTerms;
+    if (!ExtractTerms(azGrid, n, dt, maxTerms, newAzTerms) ||
+        !ExtractTerms(altGrid, n, dt, maxTerms, newAltTerms)) {
+        return false;
+    }
+
+    double rawSumSquares = 0, modelSumSquares = 0;
+    for (size_t i = 0; i < n; i++) {
+        const double t = orderedTimes[0] + i * dt;
+        const double az = azGrid[i] - Evaluate(newAzTerms, t);
+        const double alt = altGrid[i] - Evaluate(newAltTerms, t);
+        rawSumSquares += azGrid[i] * azGrid[i] + altGrid[i] * altGrid[i];
+        modelSumSquares += az * az + alt * alt;
+    }
+
+    azTerms = newAzTerms;
+    altTerms = newAltTerms;
+    modelEpoch = epoch;
+    rawRMS = std::sqrt(rawSumSquares / n);
+    modelRMS = std::sqrt(modelSumSquares / n);
+    correctedSumSquares = 0;
+    correctedSamples = 0;
+    return true;
+}
+
+/**************************************************************************************
+ ** Periodic error expected at the given time, in arcsec
+ ***************************************************************************************/
+void PolarisPEC::Predict(double jd, double &azError, double &altError) const {
+    const double t = (jd - modelEpoch) * SECONDS_PER_DAY;
+    azError = Evaluate(azTerms, t);
+    altError = Evaluate(altTerms, t);
+}
+
+/**************************************************************************************
+ ** Replace the model with previously extracted terms, recorded samples are kept
+ ***************************************************************************************/
+void PolarisPEC::SetModel(double jd, const std::vector<Term> &az, const std::vector<Term> &alt) {
+    modelEpoch = jd;
+    azTerms = az;
+    altTerms = alt;
+    rawRMS = 0;
+    modelRMS = 0;
+    correctedSumSquares = 0;
+    correctedSamples = 0;
+}
+
+/**************************************************************************************
+ ** Period of the strongest term on either axis, 0 without a model
+ ***************************************************************************************/
+double PolarisPEC::GetDominantPeriod() const {
+    const Term *dominant = nullptr;
+    for (const auto *terms : { &azTerms, &altTerms }) {
+        for (const auto &term : *terms) {
+            if (dominant == nullptr || term.amplitude > dominant->amplitude) {
+                dominant = &term;
+            }
+        }
+    }
+    return dominant != nullptr ? dominant->period : 0;
+}
+
+/**************************************************************************************
+ ** Residual RMS measured while the correction curve is played back, 0 until measured
+ ***************************************************************************************/
+double PolarisPEC::GetCorrectedRMS() const {
+    if (correctedSamples == 0) {
+        return 0;
+    }
+    return std::sqrt(correctedSumSquares / correctedSamples);
+}
+
+/**************************************************************************************
+ ** Linearly resample the ordered values onto a uniform grid and remove the linear drift
+ ***************************************************************************************/
+bool PolarisPEC::Resample(const std::vector<double> &values, std::vector<double> &grid, size_t n, double &dt) {
+    const double span = orderedTimes[n - 1] - orderedTimes[0];
+    if (span <= 0) {
+        return false;
+    }
+
+    dt = span / (n - 1);
+    size_t j = 0;
+    for (size_t i = 0; i < n; i++) {
+        const double t = orderedTimes[0] + i * dt;
+        while (j + 2 < n && orderedTimes[j + 1] < t) {
+            j++;
+        }
+        const double width = orderedTimes[j + 1] - orderedTimes[j];
+        const double fraction = width > 0 ? std::clamp((t - orderedTimes[j]) / width, 0., 1.) : 0.;
+        grid[i] = values[j] + fraction * (values[j + 1] - values[j]);
+    }
+
+    // least squares line through (i, grid[i])
+    const double meanX = (n - 1) / 2.;
+    double meanY = 0;
+    for (size_t i = 0; i < n; i++) {
+        meanY += grid[i];
+    }
+    meanY /= n;
+
+    double sxy = 0, sxx = 0;
+    for (size_t i = 0; i < n; i++) {
+        sxy += (i - meanX) * (grid[i] - meanY);
+        sxx += (i - meanX) * (i - meanX);
+    }
+    const double slope = sxx > 0 ? sxy / sxx : 0;
+    for (size_t i = 0; i < n; i++) {
+        grid[i] -= meanY + slope * (i - meanX);
+    }
+    return true;
+}
+
+/**************************************************************************************
+ ** Locate the strongest spectral peaks with an FFT, then fit each term on the grid
+ ***************************************************************************************/
+bool PolarisPEC::ExtractTerms(const std::vector<double> &grid, size_t n, double dt, size_t maxTerms, std::vector<Term> &terms) {
+    std::vector<double> &data = spectrum;
+    std::copy(grid.begin(), grid.begin() + n, data.begin());
+
+    gsl_fft_real_wavetable *wavetable = gsl_fft_real_wavetable_alloc(n);
+    gsl_fft_real_workspace *workspace = gsl_fft_real_workspace_alloc(n);
+    const int status = (wavetable != nullptr && workspace != nullptr)
+        ? gsl_fft_real_transform(data.data(), 1, n, wavetable, workspace)
+        : GSL_ENOMEM;
+    if (workspace != nullptr) {
+        gsl_fft_real_workspace_free(workspace);
+    }
+    if (wavetable != nullptr) {
+        gsl_fft_real_wavetable_free(wavetable);
+    }
+    if (status != GSL_SUCCESS) {
+        return false;
+    }
+
+    // halfcomplex layout: data[2k - 1] = Re(k), data[2k] = Im(k), data[n - 1] = Re(n / 2) for even n
+    const size_t last = n / 2;
+    auto amplitude = [&](size_t k) {
+        const double re = data[2 * k - 1];
+        const double im = (2 * k < n) ? data[2 * k] : 0.;
+        return (2 * k < n ? 2. : 1.) * std::hypot(re, im) / n;
+    };
+
+    // white noise spreads evenly over the bins, so the median amplitude is its floor
+    size_t bins = 0;
+    for (size_t k = PEC_MIN_CYCLES; k <= last; k++) {
+        amplitudes[bins++] = amplitude(k);
+    }
+    if (bins == 0) {
+        return false;
+    }
+    std::nth_element(amplitudes.begin(), amplitudes.begin() + bins / 2, amplitudes.begin() + bins);
+    const double threshold = PEC_SIGNIFICANCE * amplitudes[bins / 2];
+
+    std::vector<std::pair<double, size_t>> peaks;
+    for (size_t k = PEC_MIN_CYCLES; k <= last; k++) {
+        const double a = amplitude(k);
+        if (a > threshold && a > amplitude(k - 1) && (k == last || a >= amplitude(k + 1))) {
+            peaks.emplace_back(a, k);
+        }
+    }
+    std::sort(peaks.begin(), peaks.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    // the recording rarely spans a whole number of periods, so refine each peak between
+    // the neighbouring bins by least squares and subtract it before fitting the next one
+    std::vector<double> &residual = orderedValues;
+    std::copy(grid.begin(), grid.begin() + n, residual.begin());
+
+    const double span = n * dt;
+    const double start = orderedTimes[0];
+    auto power = [&](double omega) {
+        double a = 0, b = 0;
+        return FitTerm(residual, n, dt, omega, a, b) ? a * a + b * b : 0.;
+    };
+
+    terms.clear();
+    for (size_t i = 0; i < peaks.size() && i < maxTerms; i++) {
+        const size_t k = peaks[i].second;
+
+        // golden section search for the frequency with the strongest fit
+        const double ratio = (std::sqrt(5.) - 1) / 2;
+        double low = 2 * M_PI * (k - 1) / span, high = 2 * M_PI * (k + 1) / span;
+        double x1 = high - ratio * (high - low), x2 = low + ratio * (high - low);
+        double p1 = power(x1), p2 = power(x2);
+        for (int iteration = 0; iteration < PEC_REFINE_ITERATIONS; iteration++) {
+            if (p1 > p2) {
+                high = x2;
+                x2 = x1;
+                p2 = p1;
+                x1 = high - ratio * (high - low);
+                p1 = power(x1);
+            } else {
+                low = x1;
+                x1 = x2;
+                p1 = p2;
+                x2 = low + ratio * (high - low);
+                p2 = power(x2);
+            }
+        }
+
+        const double omega = (low + high) / 2;
+        double a = 0, b = 0;
+        if (!FitTerm(residual, n, dt, omega, a, b)) {
+            continue;
+        }
+        for (size_t j = 0; j < n; j++) {
+            residual[j] -= a * std::cos(omega * j * dt) + b * std::sin(omega * j * dt);
+        }
+
+        // a cos(wt) + b sin(wt) = A cos(wt + phi) with phi = atan2(-b, a)
+        terms.push_back({ 2 * M_PI / omega, std::hypot(a, b), std::atan2(-b, a) - omega * start });
+    }
+    return true;
+}
+
+/**************************************************************************************
+ ** Least squares fit of a cos(wt) + b sin(wt) to the first n samples
+ ***************************************************************************************/
+bool PolarisPEC::FitTerm(const std::vector<double> &data, size_t n, double dt, double omega, double &a, double &b) {
+    double cc = 0, ss = 0, cs = 0, yc = 0, ys = 0;
+    for (size_t j = 0; j < n; j++) {
+        const double c = std::cos(omega * j * dt), s = std::sin(omega * j * dt);
+        cc += c * c;
+        ss += s * s;
+        cs += c * s;
+        yc += data[j] * c;
+        ys += data[j] * s;
+    }
+
+    const double determinant = cc * ss - cs * cs;
+    if (determinant <= 0) {
+        return false;
+    }
+    a = (yc * ss - ys * cs) / determinant;
+    b = (ys * cc - yc * cs) / determinant;
+    return true;
+}
+
+/**************************************************************************************
+ ** Sum of the periodic terms at t seconds after the model epoch
+ ***************************************************************************************/
+double PolarisPEC::Evaluate(const std::vector<Term> &terms, double t) {
+    double value = 0;
+    for (const auto &term : terms) {
+        value += term.amplitude * std::cos(2 * M_PI * t / term.period + term.phase);
+    }
+    return value;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Periodic error recorder and model.
+ *
+ * Tracking residuals (measured minus expected axis position, in arcsec) are stored in a
+ * preallocated ring buffer. Only the latest continuous segment is analyzed: a gap in the
+ * samples, or Restart() when the reference changes, begins a new one. Analyze() resamples them onto a uniform grid, removes the
+ * linear drift and runs a GSL real FFT to locate the dominant periodic terms. Only peaks
+ * standing well above the spectrum's noise floor are fitted on the grid and used by
+ * Predict() to play back a correction curve. Relies on the GSL abort handler being off.
+ */
+class PolarisPEC {
+    public:
+        struct Term {
+            double period;    // seconds
+            double amplitude; // arcsec
+            double phase;     // radians, relative to the model epoch
+        };
+
+        explicit PolarisPEC(size_t capacity = 4096);
+
+        void Clear();
+        void Record(double jd, double azResidual, double altResidual);
+        void Restart();
+        void RecordCorrected(double azResidual, double altResidual);
+        bool Analyze(size_t maxTerms);
+        void Predict(double jd, double &azError, double &altError) const;
+
+        // the model alone, to persist it across restarts
+        double GetModelEpoch() const { return modelEpoch; }
+        const std::vector<Term> &GetAzTerms() const { return azTerms; }
+        const std::vector<Term> &GetAltTerms() const { return altTerms; }
+        void SetModel(double jd, const std::vector<Term> &az, const std::vector<Term> &alt);
+
+        size_t GetSampleCount() const { return segmentCount; }
+        bool IsAnalyzed() const { return !azTerms.empty() || !altTerms.empty(); }
+        double GetDominantPeriod() const;
+        double GetRawRMS() const { return rawRMS; }
+        double GetFitRMS() const { return modelRMS; }
+        double GetCorrectedRMS() const;
+
+    private:
+        bool Resample(const std::vector<double> &values, std::vector<double> &grid, size_t n, double &dt);
+        bool ExtractTerms(const std::vector<double> &grid, size_t n, double dt, size_t maxTerms, std::vector<Term> &terms);
+        static bool FitTerm(const std::vector<double> &data, size_t n, double dt, double omega, double &a, double &b);
+        static double Evaluate(const std::vector<Term> &terms, double t);
+
+        // ring buffer, allocated once
+        std::vector<double> times;
+        std::vector<double> azResiduals;
+        std::vector<double> altResiduals;
+        size_t head { 0 };
+        size_t count { 0 };
+        double epoch { 0 };
+
+        // samples since the last restart or gap, the only ones Analyze() uses
+        size_t segmentCount { 0 };
+        double segmentStart { 0 };
+        double lastTime { 0 };
+
+        // analysis scratch, allocated once
+        std::vector<double> orderedTimes;
+        std::vector<double> orderedValues;
+        std::vector<double> azGrid;
+        std::vector<double> altGrid;
+        std::vector<double> spectrum;
+        std::vector<double> amplitudes;
+
+        std::vector<Term> azTerms;
+        std::vector<Term> altTerms;
+        double modelEpoch { 0 };
+        double rawRMS { 0 };
+        double modelRMS { 0 }; // residual of the fit on the recording itself, not a measured improvement
+
+        // live residual while the correction curve is played back
+        double correctedSumSquares { 0 };
+        size_t correctedSamples { 0 };
+};
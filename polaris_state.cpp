@@ -0,0 +1,75 @@
+#include "polaris_state.h"
+
+#include "cstring"
+#include "fcntl.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "unistd.h"
+
+PolarisStateFile::~PolarisStateFile() {
+    Close();
+}
+
+/**************************************************************************************
+ ** Map the state file, creating it if needed. Returns false if it cannot be mapped;
+ ** IsLoaded() tells whether it held a valid state from a previous run
+ ***************************************************************************************/
+bool PolarisStateFile::Open(const std::string &path) {
+    Close();
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    const bool sizeMatches = fstat(fd, &info) == 0 && info.st_size == static_cast<off_t>(sizeof(PolarisState));
+    if (!sizeMatches && ftruncate(fd, sizeof(PolarisState)) != 0) {
+        Close();
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, sizeof(PolarisState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    state = static_cast<PolarisState *>(mapping);
+
+    loaded = sizeMatches
+        && state->magic == POLARIS_STATE_MAGIC
+        && state->version == POLARIS_STATE_VERSION
+        && state->size == sizeof(PolarisState);
+    if (!loaded) {
+        std::memset(state, 0, sizeof(PolarisState));
+        state->magic = POLARIS_STATE_MAGIC;
+        state->version = POLARIS_STATE_VERSION;
+        state->size = sizeof(PolarisState);
+    }
+    return true;
+}
+
+/**************************************************************************************
+ ** Write back and unmap
+ ***************************************************************************************/
+void PolarisStateFile::Close() {
+    if (state != nullptr) {
+        msync(state, sizeof(PolarisState), MS_SYNC);
+        munmap(state, sizeof(PolarisState));
+        state = nullptr;
+    }
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    loaded = false;
+}
+
+/**************************************************************************************
+ ** Schedule the write back of modified pages
+ ***************************************************************************************/
+void PolarisStateFile::Flush() {
+    if (state != nullptr) {
+        msync(state, sizeof(PolarisState), MS_ASYNC);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "polaris_pec.h"
+
+const uint32_t POLARIS_STATE_MAGIC = 0x54535042; // "BPST"
+const uint32_t POLARIS_STATE_VERSION = 2;
+const size_t POLARIS_STATE_MAX_PEC_TERMS = 8;
+
+/**
+ * Everything the driver knows about the mount, as laid out in the state file.
+ * Only plain fixed size fields, bump POLARIS_STATE_VERSION whenever the layout changes.
+ */
+struct PolarisState {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t reserved;
+
+    // device info, from 780, 775, 778 and 284
+    char hardwareVersion[32];
+    char softwareVersion[32];
+    char astroModuleVersion[32];
+    char sv[16];
+    char ov[16];
+    double batteryCapacity;
+    double storageTotal;
+    double storageFree;
+    double storageUsed;
+    int32_t mode;
+    int32_t track;
+
+    // last known pose
+    double poseJd;
+    double poseAz;
+    double poseAlt;
+
+    // park position
+    int32_t parkValid;
+    int32_t parkReserved;
+    double parkAz;
+    double parkAlt;
+    double parkDefaultAz;
+    double parkDefaultAlt;
+
+    // calibration
+    double roundTrip;
+    double minRoundTrip;
+    double pecEpoch;
+    uint32_t pecAzTermCount;
+    uint32_t pecAltTermCount;
+    PolarisPEC::Term pecAzTerms[POLARIS_STATE_MAX_PEC_TERMS];
+    PolarisPEC::Term pecAltTerms[POLARIS_STATE_MAX_PEC_TERMS];
+};
+
+/**
+ * Memory-mapped state file. Fields are updated in place through Get(), the kernel writes
+ * the pages back, so the last state survives crashes and restarts of the driver.
+ */
+class PolarisStateFile {
+    public:
+        PolarisStateFile() = default;
+        ~PolarisStateFile();
+        PolarisStateFile(const PolarisStateFile &) = delete;
+        PolarisStateFile &operator=(const PolarisStateFile &) = delete;
+
+        bool Open(const std::string &path);
+        void Close();
+        void Flush();
+
+        PolarisState *Get() const { return state; }
+        bool IsLoaded() const { return loaded; }
+
+    private:
+        int fd { -1 };
+        PolarisState *state { nullptr };
+        bool loaded { false };
+};